@@ -0,0 +1,169 @@
+/*
+ * allocbench.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Allocator benchmark.
+ *  Keeps a working set of live blocks of random small sizes and
+ *  replaces one of them OPS times, with malloc()/free() and with
+ *  ut_alloc()/ut_free(). Then THREADS threads do the same with
+ *  ut_alloc(), handing half of their blocks to each other to free.
+ *
+ *  Usage: allocbench OPS THREADS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+#include "ut_alloc.h"
+#include "ut_stats.h"
+
+#define LIVE_BLOCKS (1024)
+#define MAX_BLOCK (512)
+
+long ops;
+int threads;
+int threads_left;
+void *shared[LIVE_BLOCKS];  /* Blocks handed from thread to thread */
+void *(*thread_live)[LIVE_BLOCKS];  /* Too big for the threads' stacks */
+unsigned long ut_start_us;
+
+/* A cheap deterministic size stream */
+static inline size_t next_size(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return 1 + (*pSeed >> 16) % MAX_BLOCK;
+}
+
+void report(const char *name, long count, unsigned long elapsed_us)
+{
+	printf("%-12s %8.1f ns/op, %6.2f M ops/s\n", name,
+		   elapsed_us * 1000.0 / count, count / (double)elapsed_us);
+}
+
+void run_malloc()
+{
+	void *live[LIVE_BLOCKS] = { NULL };
+	unsigned int seed = 1;
+	unsigned long start = ut_stats_now_us();
+	long i;
+
+	for (i = 0; i < ops; ++i)
+	{
+		unsigned int slot = i % LIVE_BLOCKS;
+		free(live[slot]);
+		live[slot] = malloc(next_size(&seed));
+	}
+	report("malloc", ops, ut_stats_now_us() - start);
+
+	for (i = 0; i < LIVE_BLOCKS; ++i) free(live[i]);
+}
+
+void run_ut_alloc()
+{
+	void *live[LIVE_BLOCKS] = { NULL };
+	unsigned int seed = 1;
+	unsigned long start = ut_stats_now_us();
+	long i;
+
+	for (i = 0; i < ops; ++i)
+	{
+		unsigned int slot = i % LIVE_BLOCKS;
+		ut_free(live[slot]);
+		live[slot] = ut_alloc(next_size(&seed));
+	}
+	report("ut_alloc", ops, ut_stats_now_us() - start);
+
+	for (i = 0; i < LIVE_BLOCKS; ++i) ut_free(live[i]);
+}
+
+void churn(int index)
+{
+	void **live = thread_live[index];
+	unsigned int seed = index + 1;
+	long i;
+
+	for (i = 0; i < ops; ++i)
+	{
+		unsigned int slot = i % LIVE_BLOCKS;
+
+		ut_free(live[slot]);
+		live[slot] = ut_alloc(next_size(&seed));
+
+		/* Every other block is swapped with whichever thread's
+		 * block was left there, and freed into that one's arena.
+		 */
+		if (slot & 1)
+		{
+			void *pOther = __sync_lock_test_and_set(&shared[slot], live[slot]);
+			live[slot] = NULL;
+			ut_free(pOther);
+		}
+	}
+
+	for (i = 0; i < LIVE_BLOCKS; ++i)
+	{
+		ut_free(live[i]);
+	}
+
+	/* The owners of the shared blocks must still be alive
+	 * when they're freed, the last one to get here does it.
+	 */
+	if (__sync_sub_and_fetch(&threads_left, 1) > 0)
+	{
+		while (1)
+		{
+			ut_yield();
+		}
+	}
+
+	for (i = 0; i < LIVE_BLOCKS; ++i)
+	{
+		ut_free(shared[i]);
+	}
+
+	report("ut threads", ops * threads, ut_stats_now_us() - ut_start_us);
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc != 3){
+		printf("Usage: %s OPS THREADS\n", argv[0]);
+		exit(1);
+	}
+
+	ops = atol(argv[1]);
+	threads = atoi(argv[2]);
+
+	if (ops < 1 || threads < 1){
+		printf("Usage: %s OPS THREADS (both >= 1)\n", argv[0]);
+		exit(1);
+	}
+
+	run_malloc();
+	run_ut_alloc();
+
+	thread_live = calloc(threads, sizeof(*thread_live));
+	if (thread_live == NULL){
+		perror("calloc");
+		exit(1);
+	}
+
+	ut_init(threads);
+	threads_left = threads;
+	for (i = 0; i < threads; ++i)
+	{
+		ut_spawn_thread(churn, i);
+	}
+
+	ut_start_us = ut_stats_now_us();
+	ut_start();
+
+	return 0;
+}
@@ -12,6 +12,9 @@
 #include <stdio.h>
 
 #include "binsem.h"
+#include "ut_sched.h"
+#include "ut_coro.h"
+#include "ut_stats.h"
 
 void binsem_init(sem_t *s, int init_val)
 {
@@ -31,36 +34,99 @@ void binsem_init(sem_t *s, int init_val)
 
 void binsem_up(sem_t *s)
 {
+	tid_t waiter;
+
 	/* Must be a valid semaphore */
 	if (s == NULL) return;
 
+	/* No thread may start waiting while we look for waiters */
+	ut_preempt_disable();
+
+	/* Hand the semaphore straight to the first waiter and
+	 * let it run now. It stays 0, so no one can steal it.
+	 */
+	if (ut_handoff_enabled() && *s == 0 &&
+		(waiter = ut_wake_one(s, 1)) >= 0)
+	{
+		ut_preempt_enable();
+		ut_switch_to(waiter);
+		return;
+	}
+
+	/* Release the first waiting thread. With none, the
+	 * first waiting coroutine gets the semaphore directly.
+	 */
+	waiter = ut_wake_one(s, 0);
+	if (waiter < 0 && *s == 0 && ut_coro_sem_up(s))
+	{
+		ut_preempt_enable();
+		return;
+	}
+
 	/* Doesn't matter if it was 0 or 1, now
-	 * its 1 either way (waiting threads
-	 * will be released)
+	 * its 1 either way (the released thread
+	 * takes it once it runs)
 	 */
 	*s = 1;
+
+	ut_preempt_enable();
 }
 
 int binsem_down(sem_t *s)
 {
+	int blocked = 0;
+	int waited = 0;
+	int result = 0;
+	unsigned long wait_start = 0;
+
 	/* Must be a valid semaphore */
 	if (s == NULL) return 0;
 
-	/* Try acquiring the semaphore */
-	while (xchg(s, 0) == 0)
+	/* No up() may slip between a failed try
+	 * and our registration as a waiter
+	 */
+	ut_preempt_disable();
+
+	/* Try acquiring the semaphore. sem_t is 8 bytes on x86-64,
+	 * which atomic.h's xchg() doesn't handle.
+	 */
+	while (__sync_lock_test_and_set(s, 0) == 0)
 	{
-		/* Don't belong to us,
-		 * signal the scheduler to
-		 * run another thread
+		/* First failure, the wait starts now */
+		if (!blocked)
+		{
+			blocked = 1;
+			wait_start = ut_stats_now_us();
+		}
+
+		/* Don't belong to us, sleep until
+		 * up() wakes us. It might also hand
+		 * us the semaphore directly. Woken
+		 * and beaten to it, we keep our
+		 * place in line.
 		 */
-		kill(getpid(), SIGALRM);
+		errno = 0;
+		if (waited ? ut_wait_again(s) : ut_wait(s))
+		{
+			break;
+		}
+		waited = 1;
 
 		/* Make sure we completed ok */
 		if (errno != 0)
 		{
-			return -1;
+			result = -1;
+			break;
 		}
 	}
 
-	return 0;
+	ut_preempt_enable();
+
+	/* Account for the time we waited */
+	if (blocked)
+	{
+		ut_stats_record_wait(ut_stats_now_us() - wait_start);
+	}
+
+	return result;
 }
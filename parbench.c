@@ -0,0 +1,214 @@
+/*
+ * parbench.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Parallel loops benchmark.
+ *  Times an array sum (ut_parallel_reduce) and an in-place map
+ *  (ut_parallel_for) over SIZE elements against a serial loop and,
+ *  when built with -fopenmp, against OpenMP.
+ *
+ *  Usage: parbench SIZE WORKERS [REPEAT]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "ut.h"
+#include "ut_par.h"
+#include "ut_task.h"
+#include "ut_stats.h"
+
+#define DEFAULT_REPEAT (10)
+
+long size;
+int repeat;
+long *array;
+long serial_sum;  /* Keeps the serial loop from being optimized out */
+
+/* The map's work per element, a few multiplications */
+static inline long map_one(long value)
+{
+	return (value * 2654435761L) ^ (value >> 7);
+}
+
+long sum_chunk(long begin, long end, void *ctx)
+{
+	long *pArray = ctx;
+	long sum = 0;
+	long i;
+
+	for (i = begin; i < end; ++i)
+	{
+		sum += pArray[i];
+	}
+
+	return sum;
+}
+
+long add(long a, long b, void *ctx)
+{
+	return a + b;
+}
+
+void map_chunk(long begin, long end, void *ctx)
+{
+	long *pArray = ctx;
+	long i;
+
+	for (i = begin; i < end; ++i)
+	{
+		pArray[i] = map_one(pArray[i]);
+	}
+}
+
+void report(const char *name, unsigned long sum_us, unsigned long map_us)
+{
+	printf("%-8s sum %8.3f ms, map %8.3f ms\n", name,
+		   sum_us / 1000.0 / repeat, map_us / 1000.0 / repeat);
+}
+
+void run_serial()
+{
+	unsigned long start;
+	unsigned long sum_us;
+	int r;
+
+	start = ut_stats_now_us();
+	for (r = 0; r < repeat; ++r)
+	{
+		serial_sum = sum_chunk(0, size, array);
+	}
+	sum_us = ut_stats_now_us() - start;
+
+	start = ut_stats_now_us();
+	for (r = 0; r < repeat; ++r)
+	{
+		map_chunk(0, size, array);
+	}
+
+	report("serial", sum_us, ut_stats_now_us() - start);
+}
+
+#ifdef _OPENMP
+void run_openmp()
+{
+	unsigned long start;
+	unsigned long sum_us;
+	long expected = sum_chunk(0, size, array);
+	long sum = 0;
+	long i;
+	int r;
+
+	start = ut_stats_now_us();
+	for (r = 0; r < repeat; ++r)
+	{
+		sum = 0;
+		#pragma omp parallel for reduction(+:sum)
+		for (i = 0; i < size; ++i)
+		{
+			sum += array[i];
+		}
+	}
+	sum_us = ut_stats_now_us() - start;
+
+	start = ut_stats_now_us();
+	for (r = 0; r < repeat; ++r)
+	{
+		#pragma omp parallel for
+		for (i = 0; i < size; ++i)
+		{
+			array[i] = map_one(array[i]);
+		}
+	}
+
+	report("openmp", sum_us, ut_stats_now_us() - start);
+
+	if (sum != expected) printf("openmp: wrong sum\n");
+}
+#endif
+
+void run_ut(int arg)
+{
+	unsigned long start;
+	unsigned long sum_us;
+	long expected = sum_chunk(0, size, array);
+	long sum = 0;
+	int r;
+
+	start = ut_stats_now_us();
+	for (r = 0; r < repeat; ++r)
+	{
+		sum = ut_parallel_reduce(0, size, 0, 0, sum_chunk, add, array);
+	}
+	sum_us = ut_stats_now_us() - start;
+
+	start = ut_stats_now_us();
+	for (r = 0; r < repeat; ++r)
+	{
+		ut_parallel_for(0, size, 0, map_chunk, array);
+	}
+
+	report("ut", sum_us, ut_stats_now_us() - start);
+
+	if (sum != expected) printf("ut: wrong sum\n");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int workers;
+	long i;
+
+	if (argc < 3 || argc > 4){
+		printf("Usage: %s SIZE WORKERS [REPEAT]\n", argv[0]);
+		exit(1);
+	}
+
+	size = atol(argv[1]);
+	workers = atoi(argv[2]);
+	repeat = (argc == 4) ? atoi(argv[3]) : DEFAULT_REPEAT;
+
+	if (size < 1 || workers < 1 || repeat < 1){
+		printf("Usage: %s SIZE WORKERS [REPEAT] (all >= 1)\n", argv[0]);
+		exit(1);
+	}
+
+	array = malloc(size * sizeof(long));
+	if (array == NULL){
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = 0; i < size; ++i){
+		array[i] = i;
+	}
+
+	run_serial();
+
+#ifdef _OPENMP
+	{
+		sigset_t timers, saved;
+
+		/* OpenMP's threads must never get the scheduler's signals */
+		sigemptyset(&timers);
+		sigaddset(&timers, SIGALRM);
+		sigaddset(&timers, SIGVTALRM);
+		sigprocmask(SIG_BLOCK, &timers, &saved);
+
+		run_openmp();
+
+		sigprocmask(SIG_SETMASK, &saved, NULL);
+	}
+#endif
+
+	ut_init(workers + 1);
+	ut_task_pool_init(workers);
+	ut_spawn_thread(run_ut, 0);
+
+	ut_start();
+
+	return 0;
+}
@@ -4,12 +4,14 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
 #include "binsem.h"
 #include "ut.h"
+#include "ut_log.h"
 
 
 
@@ -20,6 +22,7 @@
 #define EATING   2
 
 int N;
+volatile sig_atomic_t interrupted = 0;
 
 volatile int *phil_state;
 sem_t *s;
@@ -29,25 +32,25 @@ void think(int p) {
   int i, factor;
   volatile int j;
 
-  printf("Philosopher (%d) is thinking\n",p); fflush (stdout);
+  ut_log("Philosopher (%d) is thinking\n",p);
 
   factor = 1 + random()%5;
 
-  for (i = 0; i < 100000000*factor; i++){
+  for (i = 0; i < 100000000*factor && !interrupted; i++){
     j += (int) i*i;
   }
             
-  printf("Philosopher (%d) is hungry\n", p); fflush (stdout);
+  ut_log("Philosopher (%d) is hungry\n", p);
 }
 
 void eat(int p){
   int i, factor;
   volatile int j;
 
-   printf("Philosopher (%d) is eating\n", p); fflush (stdout);
+   ut_log("Philosopher (%d) is eating\n", p);
 
    factor = 1 + random()%5;
-   for (i = 0; i < 100000000*factor; i++){
+   for (i = 0; i < 100000000*factor && !interrupted; i++){
       j += (int) i*i;
    }
 }
@@ -86,10 +89,18 @@ void put_forks(int i){
   binsem_up(&mutex);
 }
 
+/* Only tells the philosophers to stop, the log
+   can't be flushed from inside a handler */
 void int_handler(int signo) {
+  interrupted = 1;
+}
+
+void report(void) {
   long int duration;
   int i;
 
+  ut_log_flush();
+
   for (i = 0; i < N; i++) {
     duration = ut_get_vtime(i);
     printf("Philosopher (%d) used the CPU %ld.%ld sec.\n",
@@ -99,17 +110,21 @@ void int_handler(int signo) {
 }
 
 void philosopher(int i){
-  while (1){
+  while (!interrupted){
     think(i);
     take_forks(i);
     eat(i);
     put_forks(i);
   }
+
+  /* The first one to notice reports */
+  report();
 }
 
 int main(int argc, char *argv[])
 {
   int c;
+  struct sigaction sa;
   if (argc != 2){
     printf("Usage: %s N\n", argv[0]);
     exit(1);
@@ -117,12 +132,16 @@ int main(int argc, char *argv[])
   
   N = atoi(argv[1]);
 
-  if (N < 2){
-    printf("Usage: %s N (N >=2)\n", argv[0]);
+  /* One more slot for the log drainer */
+  if (N < 2 || N > MAX_TAB_SIZE - 1){
+    printf("Usage: %s N (2 <= N <= %d)\n", argv[0], MAX_TAB_SIZE - 1);
     exit(1);
   }
   
-  ut_init(N);
+  if (ut_init(N + 1) != 0){
+    printf("Can't init the threads\n");
+    exit(1);
+  }
   s = (sem_t *)malloc (N * sizeof(sem_t));
   phil_state = (int *) malloc (N * sizeof(int));
 
@@ -133,12 +152,24 @@ int main(int argc, char *argv[])
   }
 
   for (c = 0; c < N ; c++){
-    ut_spawn_thread(philosopher,c);
+    if (ut_spawn_thread(philosopher,c) < 0){
+      printf("Can't spawn philosopher %d\n", c);
+      exit(1);
+    }
+  }
+
+  if (ut_log_init(STDOUT_FILENO) != 0){
+    printf("Can't start the log\n");
+    exit(1);
   }
 
   binsem_init(&mutex, 1);
 
-  signal(SIGINT,int_handler);
+  /* On the library's signal stack, the threads' stacks are small */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = int_handler;
+  sa.sa_flags = SA_ONSTACK;
+  sigaction(SIGINT, &sa, NULL);
   ut_start();
  
   return 0; // avoid warnings
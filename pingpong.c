@@ -0,0 +1,127 @@
+/*
+ * pingpong.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Semaphore wake-up latency benchmark.
+ *  Two threads pass a token back and forth through a pair of
+ *  semaphores while BUSY other threads burn CPU. Without handoff, a
+ *  woken thread waits for its round-robin turn behind the busy ones;
+ *  with handoff, up() switches to it directly. With adaptive time
+ *  slices, the busy threads get longer slices and the pair short ones.
+ *
+ *  Usage: pingpong ROUNDS BUSY [handoff|adaptive]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binsem.h"
+#include "ut.h"
+#include "ut_sched.h"
+#include "ut_stats.h"
+
+#define ADAPTIVE_MIN_USEC (1000)
+#define ADAPTIVE_MAX_USEC (100000)
+
+int rounds;
+const char *mode = "normal";
+sem_t ping_sem;
+sem_t pong_sem;
+unsigned long total_us;
+unsigned long max_us;
+
+void busy(int i)
+{
+	volatile unsigned long j = 0;
+
+	while (1)
+	{
+		j++;
+	}
+}
+
+void pong(int i)
+{
+	while (1)
+	{
+		binsem_down(&pong_sem);
+		binsem_up(&ping_sem);
+	}
+}
+
+void ping(int i)
+{
+	unsigned long begin = ut_stats_now_us();
+	ut_sched_stats_t stats;
+	int round;
+
+	for (round = 0; round < rounds; round++)
+	{
+		unsigned long start = ut_stats_now_us();
+		unsigned long elapsed;
+
+		binsem_up(&pong_sem);
+		binsem_down(&ping_sem);
+
+		elapsed = ut_stats_now_us() - start;
+		total_us += elapsed;
+		if (elapsed > max_us) max_us = elapsed;
+	}
+
+	ut_get_sched_stats(SYS_ERR, &stats);
+
+	printf("%s: %d round trips, avg %lu us, max %lu us\n",
+		   mode, rounds, total_us / rounds, max_us);
+	printf("%s: p99 wake latency %lu us, %.1f switches/s\n",
+		   mode, ut_hist_percentile(&stats.ready_latency_us, 99),
+		   (stats.preempted + stats.blocked) * 1000000.0 /
+		   (ut_stats_now_us() - begin));
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int busy_threads;
+	int c;
+
+	if (argc < 3 || argc > 4){
+		printf("Usage: %s ROUNDS BUSY [handoff|adaptive]\n", argv[0]);
+		exit(1);
+	}
+
+	rounds = atoi(argv[1]);
+	busy_threads = atoi(argv[2]);
+
+	if (rounds < 1 || busy_threads < 0){
+		printf("Usage: %s ROUNDS BUSY [handoff|adaptive] (ROUNDS >= 1)\n", argv[0]);
+		exit(1);
+	}
+
+	if (argc == 4 && strcmp(argv[3], "handoff") == 0){
+		mode = "handoff";
+		ut_set_handoff(1);
+	}
+	else if (argc == 4 && strcmp(argv[3], "adaptive") == 0){
+		mode = "adaptive";
+		ut_set_adaptive_slices(ADAPTIVE_MIN_USEC, ADAPTIVE_MAX_USEC);
+	}
+
+	ut_init(busy_threads + 2);
+
+	binsem_init(&ping_sem, 0);
+	binsem_init(&pong_sem, 0);
+
+	ut_spawn_thread(ping, 0);
+	ut_spawn_thread(pong, 0);
+
+	for (c = 0; c < busy_threads; c++){
+		ut_spawn_thread(busy, c);
+	}
+
+	ut_start();
+
+	return 0;
+}
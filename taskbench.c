@@ -0,0 +1,148 @@
+/*
+ * taskbench.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Task pool throughput benchmark.
+ *  A thread posts TASKS empty tasks to WORKERS workers, then submits
+ *  them in batches and collects every future, then runs tasks that
+ *  wait for tasks they submitted, nested up to DEPTH deep.
+ *
+ *  Usage: taskbench TASKS WORKERS [DEPTH]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+#include "ut_task.h"
+#include "ut_stats.h"
+
+#define BATCH (1024)
+#define DEFAULT_DEPTH (32)
+
+long tasks;
+int depth;
+volatile long tasks_done;
+ut_future_t *batch[BATCH];
+
+void *count_task(void *ctx)
+{
+	__sync_fetch_and_add(&tasks_done, 1);
+	return NULL;
+}
+
+void *echo_task(void *ctx)
+{
+	return ctx;
+}
+
+/* Submits the next level and waits for it */
+void *nested_task(void *ctx)
+{
+	long level = (long)ctx;
+
+	if (level > 1)
+	{
+		return (void *)(level + (long)ut_future_get(
+			ut_task_submit(nested_task, (void *)(level - 1))));
+	}
+
+	return (void *)level;
+}
+
+void report(const char *name, long count, unsigned long elapsed_us)
+{
+	printf("%-8s %10ld tasks, %8.1f ns/task, %6.2f M tasks/s\n", name,
+		   count, elapsed_us * 1000.0 / count, count / (double)elapsed_us);
+}
+
+void run_bench(int arg)
+{
+	unsigned long start;
+	long nested_runs = tasks / depth;
+	long i;
+
+	/* Fire and forget */
+	start = ut_stats_now_us();
+	for (i = 0; i < tasks; ++i)
+	{
+		ut_task_post(count_task, NULL);
+	}
+	while (tasks_done < tasks)
+	{
+		if (!ut_task_run_one()) ut_yield();
+	}
+	report("post", tasks, ut_stats_now_us() - start);
+
+	/* With a result for each */
+	start = ut_stats_now_us();
+	for (i = 0; i < tasks; i += BATCH)
+	{
+		long j;
+
+		for (j = 0; j < BATCH; ++j)
+		{
+			batch[j] = ut_task_submit(echo_task, (void *)j);
+		}
+
+		for (j = 0; j < BATCH; ++j)
+		{
+			if ((long)ut_future_get(batch[j]) != j)
+			{
+				printf("submit: wrong result\n");
+				exit(1);
+			}
+		}
+	}
+	report("submit", i, ut_stats_now_us() - start);
+
+	/* Waits inside tasks */
+	start = ut_stats_now_us();
+	for (i = 0; i < nested_runs; ++i)
+	{
+		long sum = (long)ut_future_get(
+			ut_task_submit(nested_task, (void *)(long)depth));
+
+		if (sum != (long)depth * (depth + 1) / 2)
+		{
+			printf("nested: wrong result\n");
+			exit(1);
+		}
+	}
+	if (nested_runs > 0)
+	{
+		report("nested", nested_runs * depth, ut_stats_now_us() - start);
+	}
+
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int workers;
+
+	if (argc < 3 || argc > 4){
+		printf("Usage: %s TASKS WORKERS [DEPTH]\n", argv[0]);
+		exit(1);
+	}
+
+	tasks = atol(argv[1]);
+	workers = atoi(argv[2]);
+	depth = (argc == 4) ? atoi(argv[3]) : DEFAULT_DEPTH;
+
+	if (tasks < 1 || workers < 1 || depth < 1){
+		printf("Usage: %s TASKS WORKERS [DEPTH] (all >= 1)\n", argv[0]);
+		exit(1);
+	}
+
+	ut_init(workers + 1);
+	ut_task_pool_init(workers);
+	ut_spawn_thread(run_bench, 0);
+
+	ut_start();
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * test.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Helpers shared by the tests. A test defines TEST_NAME before
+ *  including this file, prints "<name>: passed" and exits with 0,
+ *  or exits with 1 on the first failed CHECK().
+ */
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s: line %d: %s failed\n", TEST_NAME, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+/* A scenario runs in a child process and exits with its status */
+typedef void (*test_scenario_fn)(void *arg);
+
+/*****************************************************************************
+ Runs a scenario in a child process, as ut_start() runs once per process,
+ and waits for it.
+
+ Parameters:
+    scenario - the scenario, must exit rather than return.
+    arg - the argument passed to the scenario.
+    timeout_ms - how long to wait before killing the child, 0 to wait
+                 for as long as it runs.
+
+ Returns:
+    the child's exit status, -1 if it was killed or timed out.
+ ****************************************************************************/
+static inline int test_run(test_scenario_fn scenario, void *arg, int timeout_ms)
+{
+	pid_t pid;
+	int status = 0;
+	int waited_ms;
+
+	fflush(stdout);
+	pid = fork();
+	CHECK(pid >= 0);
+
+	if (pid == 0)
+	{
+		scenario(arg);
+		exit(1);
+	}
+
+	if (timeout_ms == 0)
+	{
+		CHECK(waitpid(pid, &status, 0) == pid);
+	}
+	else
+	{
+		for (waited_ms = 0; waited_ms < timeout_ms; ++waited_ms)
+		{
+			if (waitpid(pid, &status, WNOHANG) == pid) break;
+			usleep(1000);
+		}
+
+		if (waited_ms == timeout_ms)
+		{
+			kill(pid, SIGKILL);
+			waitpid(pid, &status, 0);
+			printf("%s: a scenario didn't finish\n", TEST_NAME);
+			return -1;
+		}
+	}
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+#endif
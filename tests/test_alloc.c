@@ -0,0 +1,166 @@
+/*
+ * test_alloc.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of ut_alloc: size classes, large and oversized requests,
+ *  freeing from another thread and resetting an arena.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+#include "ut_alloc.h"
+
+#define TEST_NAME "test_alloc"
+
+#include "test.h"
+
+#define REMOTE_SIZE (200)
+
+void *volatile remote_block = NULL;
+volatile int remote_freed = 0;
+
+/* Sizes of every class, none of them in REMOTE_SIZE's class */
+static const size_t class_sizes[] = { 1, 16, 17, 48, 100, 1000, 2000, 4000,
+									  UT_ALLOC_MAX_SMALL };
+
+void check_classes()
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(class_sizes) / sizeof(class_sizes[0]); ++i)
+	{
+		size_t size = class_sizes[i];
+		char *p = ut_alloc(size);
+		char *q = ut_alloc(size);
+
+		CHECK(p != NULL && q != NULL && p != q);
+		CHECK((uintptr_t)p % UT_ALLOC_ALIGN == 0);
+		CHECK((uintptr_t)q % UT_ALLOC_ALIGN == 0);
+
+		/* The whole payload is usable, neighbours aren't touched */
+		memset(p, 0x11, size);
+		memset(q, 0x22, size);
+		CHECK(p[0] == 0x11 && p[size - 1] == 0x11);
+
+		/* A freed block is reused by its own class */
+		ut_free(p);
+		CHECK(ut_alloc(size) == p);
+
+		ut_free(q);
+		ut_free(p);
+	}
+
+	/* Same class (with the header, up to 64 bytes) */
+	{
+		void *p = ut_alloc(17);
+		ut_free(p);
+		CHECK(ut_alloc(40) == p);
+		ut_free(p);
+	}
+
+	/* Different classes */
+	{
+		void *p = ut_alloc(16);
+		void *q;
+		ut_free(p);
+		q = ut_alloc(17);
+		CHECK(q != p);
+		ut_free(q);
+	}
+}
+
+void check_large()
+{
+	char *p = ut_alloc(UT_ALLOC_MAX_SMALL + 1);
+	char *q = ut_alloc(1024 * 1024);
+
+	CHECK(p != NULL && q != NULL);
+	CHECK((uintptr_t)p % UT_ALLOC_ALIGN == 0);
+	memset(p, 0x33, UT_ALLOC_MAX_SMALL + 1);
+	memset(q, 0x44, 1024 * 1024);
+	ut_free(p);
+	ut_free(q);
+
+	/* The header doesn't fit, the size must not wrap around */
+	CHECK(ut_alloc(SIZE_MAX) == NULL);
+	CHECK(ut_alloc(SIZE_MAX - 8) == NULL);
+}
+
+void owner(int arg)
+{
+	void *p;
+
+	check_classes();
+	check_large();
+
+	/* Handed over to the other thread, which frees it */
+	p = ut_alloc(REMOTE_SIZE);
+	CHECK(p != NULL);
+	remote_block = p;
+
+	while (!remote_freed)
+	{
+		ut_yield();
+	}
+
+	/* Given back through the remote list */
+	CHECK(ut_alloc(REMOTE_SIZE) == p);
+	ut_free(p);
+
+	printf("test_alloc: passed\n");
+	exit(0);
+}
+
+void freer(int arg)
+{
+	while (remote_block == NULL)
+	{
+		ut_yield();
+	}
+
+	ut_free(remote_block);
+	remote_freed = 1;
+}
+
+void check_reset()
+{
+	void *p1 = ut_alloc(64);
+	void *p2 = ut_alloc(64);
+	char *q;
+
+	CHECK(p1 != NULL && p2 != NULL);
+	ut_free(p2);
+
+	/* The freed block went away with the arena */
+	ut_alloc_reset(SYS_ERR);
+	q = ut_alloc(64);
+	CHECK(q != NULL && q != p2);
+	memset(q, 0x55, 64);
+	ut_free(q);
+}
+
+int main()
+{
+	/* The main context has its own arena */
+	check_reset();
+
+	if (ut_init(2) != 0)
+	{
+		printf("test_alloc: ut_init failed\n");
+		return 1;
+	}
+
+	ut_spawn_thread(owner, 0);
+	ut_spawn_thread(freer, 0);
+	ut_start();
+
+	printf("test_alloc: the threads never finished\n");
+	return 1;
+}
@@ -0,0 +1,130 @@
+/*
+ * test_binsem.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the semaphore's wake order: the waiters get the semaphore
+ *  in the order they blocked, with and without the direct handoff.
+ *  Without it, a thread may take the semaphore between an up() and the
+ *  woken waiter's run - the waiter blocks again, and must keep its
+ *  place in line. Each mode runs in a child process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "binsem.h"
+#include "ut.h"
+#include "ut_sched.h"
+
+#define TEST_NAME "test_binsem"
+
+#include "test.h"
+
+#define CHILD_TIMEOUT_MSEC (60000)
+#define NUM_WAITERS (5)
+#define SETTLE_YIELDS (10)
+
+sem_t sem;
+volatile int started = 0;
+volatile int done = 0;
+int order[NUM_WAITERS];
+
+void waiter(int index)
+{
+	started++;
+	CHECK(binsem_down(&sem) == 0);
+
+	order[done++] = index;
+
+	binsem_up(&sem);
+}
+
+/* Lets the others run until they block */
+void settle()
+{
+	int i;
+
+	for (i = 0; i < SETTLE_YIELDS; ++i)
+	{
+		ut_yield();
+	}
+}
+
+void driver(int handoff)
+{
+	int i;
+
+	/* They run first, and block in order */
+	while (started < NUM_WAITERS)
+	{
+		ut_yield();
+	}
+	settle();
+
+	if (handoff)
+	{
+		/* The first waiter gets it right away, we wait behind the others */
+		binsem_up(&sem);
+		CHECK(binsem_down(&sem) == 0);
+		CHECK(done == NUM_WAITERS);
+	}
+	else
+	{
+		/* Wake the first waiter, and take the semaphore before it runs */
+		ut_preempt_disable();
+		binsem_up(&sem);
+		CHECK(binsem_down(&sem) == 0);
+		ut_preempt_enable();
+
+		/* It finds the semaphore taken and blocks again */
+		settle();
+		CHECK(done == 0);
+
+		binsem_up(&sem);
+		while (done < NUM_WAITERS)
+		{
+			ut_yield();
+		}
+	}
+
+	for (i = 0; i < NUM_WAITERS; ++i)
+	{
+		CHECK(order[i] == i);
+	}
+
+	exit(0);
+}
+
+void wake_order(void *arg)
+{
+	int handoff = *(int *)arg;
+	int i;
+
+	CHECK(ut_init(NUM_WAITERS + 1) == 0);
+	binsem_init(&sem, 0);
+	ut_set_handoff(handoff);
+
+	for (i = 0; i < NUM_WAITERS; ++i)
+	{
+		CHECK(ut_spawn_thread(waiter, i) >= 0);
+	}
+	CHECK(ut_spawn_thread(driver, handoff) >= 0);
+
+	ut_start();
+	exit(1);
+}
+
+int main()
+{
+	int handoff;
+
+	for (handoff = 0; handoff <= 1; ++handoff)
+	{
+		CHECK(test_run(wake_order, &handoff, CHILD_TIMEOUT_MSEC) == 0);
+	}
+
+	printf("test_binsem: passed\n");
+	return 0;
+}
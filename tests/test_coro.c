@@ -0,0 +1,238 @@
+/*
+ * test_coro.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Scale test of the coroutines: a million of them wait for a thousand
+ *  semaphores. While they all wait, a round of the carrier must not
+ *  depend on their number, and neither may the memory per coroutine.
+ *  Then every semaphore is raised once, and each coroutine passes it on
+ *  to the next one waiting. And with nothing ready, the carrier must
+ *  sleep until the next coroutine is due: in a simulation, where the
+ *  clock only moves when every thread sleeps, and without taking the
+ *  CPU otherwise. Each scenario runs in a child process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+#include "ut_coro.h"
+#include "ut_stats.h"
+
+#define TEST_NAME "test_coro"
+
+#include "test.h"
+
+#define NUM_COROS (1000000)
+#define NUM_SEMS (1000)
+#define IDLE_ROUNDS (1000)
+#define MAX_IDLE_US (1000000)      /* For all the idle rounds together */
+#define MAX_WAIT_BYTES (8)         /* Per waiting coroutine, on average */
+#define NAP_MSEC (5)
+#define NAPS (3)
+#define IDLE_MSEC (300)
+#define MAX_IDLE_CPU_MSEC (30)
+#define TIMEOUT_MSEC (60000)
+
+ut_coro_t *coros;
+sem_t sems[NUM_SEMS];
+volatile long started = 0;
+volatile long acquired = 0;
+
+/* Resident memory, in bytes (no stdio, it mallocs) */
+long rss_bytes()
+{
+	char buffer[128];
+	long pages = 0;
+	int fd = open("/proc/self/statm", O_RDONLY);
+
+	if (fd >= 0)
+	{
+		ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+
+		if (length > 0)
+		{
+			buffer[length] = '\0';
+			if (sscanf(buffer, "%*s %ld", &pages) != 1) pages = 0;
+		}
+		close(fd);
+	}
+
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+int waiter(ut_coro_t *co)
+{
+	sem_t *pSem = &sems[(long)co->ctx % NUM_SEMS];
+
+	UT_CORO_BEGIN(co);
+
+	started++;
+	UT_CORO_WAIT_SEM(co, pSem);
+
+	/* Owns it, pass it on */
+	acquired++;
+	binsem_up(pSem);
+
+	UT_CORO_END(co);
+}
+
+void driver(int arg)
+{
+	unsigned long start;
+	long rss_before;
+	long i;
+
+	/* Everyone ran once and waits */
+	rss_before = rss_bytes();
+	while (started < NUM_COROS)
+	{
+		ut_yield();
+	}
+	CHECK(acquired == 0);
+
+	/* The carrier blocks, the waiters must not slow the switches down */
+	start = ut_stats_now_us();
+	for (i = 0; i < IDLE_ROUNDS; ++i)
+	{
+		ut_yield();
+	}
+	printf("test_coro: %d idle rounds with %d waiting: %lu us\n",
+		   IDLE_ROUNDS, NUM_COROS, ut_stats_now_us() - start);
+	CHECK(ut_stats_now_us() - start < MAX_IDLE_US);
+
+	printf("test_coro: %ld bytes per waiting coroutine\n",
+		   (rss_bytes() - rss_before) / NUM_COROS);
+	CHECK((rss_bytes() - rss_before) / NUM_COROS <= MAX_WAIT_BYTES);
+
+	/* Each semaphore goes through all of its waiters */
+	start = ut_stats_now_us();
+	for (i = 0; i < NUM_SEMS; ++i)
+	{
+		binsem_up(&sems[i]);
+	}
+	while (acquired < NUM_COROS)
+	{
+		ut_yield();
+	}
+	printf("test_coro: %d hand overs: %lu us\n",
+		   NUM_COROS, ut_stats_now_us() - start);
+
+	exit(0);
+}
+
+void scale(void *arg)
+{
+	long i;
+
+	coros = calloc(NUM_COROS, sizeof(ut_coro_t));
+	CHECK(coros != NULL);
+
+	for (i = 0; i < NUM_SEMS; ++i)
+	{
+		binsem_init(&sems[i], 0);
+	}
+
+	CHECK(ut_init(2) == 0);
+	CHECK(ut_coro_init() == 0);
+	CHECK(ut_spawn_thread(driver, 0) >= 0);
+
+	for (i = 0; i < NUM_COROS; ++i)
+	{
+		ut_coro_spawn(&coros[i], waiter, (void *)i);
+	}
+
+	ut_start();
+}
+
+/* Naps a few times, then checks how long it took */
+int napper(ut_coro_t *co)
+{
+	static unsigned long start;
+	static int naps;
+
+	UT_CORO_BEGIN(co);
+
+	start = ut_coro_now_ms();
+	for (naps = 0; naps < NAPS; ++naps)
+	{
+		UT_CORO_SLEEP(co, NAP_MSEC);
+	}
+
+	CHECK(ut_coro_now_ms() - start >= NAPS * NAP_MSEC);
+	exit(0);
+
+	UT_CORO_END(co);
+}
+
+/* Keeps the simulation from ending while the napper naps */
+void bystander(int arg)
+{
+	ut_sleep(10 * NAPS * NAP_MSEC);
+	exit(1);
+}
+
+void in_simulation(void *arg)
+{
+	static ut_coro_t co;
+
+	CHECK(ut_init(2) == 0);
+	CHECK(ut_sim_enable(1) == 0);
+	CHECK(ut_coro_init() == 0);
+	CHECK(ut_spawn_thread(bystander, 0) >= 0);
+	ut_coro_spawn(&co, napper, NULL);
+
+	ut_start();
+}
+
+int long_napper(ut_coro_t *co)
+{
+	UT_CORO_BEGIN(co);
+	UT_CORO_SLEEP(co, 10 * IDLE_MSEC);
+	UT_CORO_END(co);
+}
+
+/* Measures the CPU time of a carrier with nothing to run */
+void idle_driver(int arg)
+{
+	clock_t start;
+	long cpu_msec;
+
+	start = clock();
+	ut_sleep(IDLE_MSEC);
+	cpu_msec = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+	printf("test_coro: an idle carrier took %ld ms of CPU in %d ms\n",
+		   cpu_msec, IDLE_MSEC);
+	CHECK(cpu_msec < MAX_IDLE_CPU_MSEC);
+
+	exit(0);
+}
+
+void idle_carrier(void *arg)
+{
+	static ut_coro_t co;
+
+	CHECK(ut_init(2) == 0);
+	CHECK(ut_coro_init() == 0);
+	CHECK(ut_spawn_thread(idle_driver, 0) >= 0);
+	ut_coro_spawn(&co, long_napper, NULL);
+
+	ut_start();
+}
+
+int main()
+{
+	CHECK(test_run(scale, NULL, TIMEOUT_MSEC) == 0);
+	CHECK(test_run(in_simulation, NULL, TIMEOUT_MSEC) == 0);
+	CHECK(test_run(idle_carrier, NULL, TIMEOUT_MSEC) == 0);
+
+	printf("test_coro: passed\n");
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * test_groups.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the groups' CPU quotas, in simulations: CPU-bound threads
+ *  must get about their group's quota, whether they compete with an
+ *  unlimited thread or with other groups. Each simulation runs in a
+ *  child process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+
+#define TEST_NAME "test_groups"
+
+#include "test.h"
+
+#define SEED (42)
+#define RUN_MSEC (20000)          /* Virtual time of a simulation */
+#define PERIOD_USEC (100000)
+#define SLICE_MIN_USEC (1000)
+#define SLICE_MAX_USEC (10000)
+#define TOLERANCE (5)             /* Percent of the run */
+
+typedef struct _expected_share {
+	tid_t tid;
+	int percent;
+} expected_share_t;
+
+expected_share_t *expected;
+int num_expected;
+
+void hog(int arg)
+{
+	while (1)
+	{
+		ut_sim_point();
+	}
+}
+
+/* Sleeps through the run, then checks everyone's share */
+void monitor(int arg)
+{
+	unsigned long start = ut_now_ms();
+	unsigned long elapsed;
+	int failed = 0;
+	int i;
+
+	ut_sleep(RUN_MSEC);
+	elapsed = ut_now_ms() - start;
+
+	for (i = 0; i < num_expected; ++i)
+	{
+		int percent = ut_get_vtime(expected[i].tid) * 100 / elapsed;
+
+		printf("test_groups: thread %d got %d%% (expected %d%%)\n",
+			   expected[i].tid, percent, expected[i].percent);
+
+		if (percent < expected[i].percent - TOLERANCE ||
+			percent > expected[i].percent + TOLERANCE)
+		{
+			failed = 1;
+		}
+	}
+
+	exit(failed);
+}
+
+/* Starts a simulation of the spawned threads */
+void simulate(expected_share_t *pExpected, int count)
+{
+	expected = pExpected;
+	num_expected = count;
+
+	CHECK(ut_spawn_thread(monitor, 0) >= 0);
+	CHECK(ut_sim_enable(SEED) == 0);
+	CHECK(ut_set_adaptive_slices(SLICE_MIN_USEC, SLICE_MAX_USEC) == 0);
+
+	ut_start();
+	exit(1);
+}
+
+/* A 30% group of one thread, against an unlimited thread */
+void against_unlimited(void *arg)
+{
+	expected_share_t shares[2];
+	int group;
+
+	CHECK(ut_init(3) == 0);
+	group = ut_group_create();
+	CHECK(group >= 0);
+	CHECK(ut_group_set_quota(group, PERIOD_USEC, PERIOD_USEC * 30 / 100) == 0);
+
+	shares[0].tid = ut_spawn_thread(hog, 0);
+	shares[0].percent = 30;
+	CHECK(ut_group_add(group, shares[0].tid) == 0);
+
+	shares[1].tid = ut_spawn_thread(hog, 0);
+	shares[1].percent = 70;
+
+	simulate(shares, 2);
+}
+
+/* A 20% group of two threads and a 50% group of one, idle otherwise */
+void two_groups(void *arg)
+{
+	expected_share_t shares[3];
+	int small, big;
+
+	CHECK(ut_init(4) == 0);
+	small = ut_group_create();
+	big = ut_group_create();
+	CHECK(small >= 0 && big >= 0);
+	CHECK(ut_group_set_quota(small, PERIOD_USEC, PERIOD_USEC * 20 / 100) == 0);
+	CHECK(ut_group_set_quota(big, PERIOD_USEC, PERIOD_USEC * 50 / 100) == 0);
+
+	/* The small group's mates share its quota evenly */
+	shares[0].tid = ut_spawn_thread(hog, 0);
+	shares[0].percent = 10;
+	shares[1].tid = ut_spawn_thread(hog, 0);
+	shares[1].percent = 10;
+	CHECK(ut_group_add(small, shares[0].tid) == 0);
+	CHECK(ut_group_add(small, shares[1].tid) == 0);
+
+	shares[2].tid = ut_spawn_thread(hog, 0);
+	shares[2].percent = 50;
+	CHECK(ut_group_add(big, shares[2].tid) == 0);
+
+	simulate(shares, 3);
+}
+
+int main()
+{
+	CHECK(test_run(against_unlimited, NULL, 0) == 0);
+	CHECK(test_run(two_groups, NULL, 0) == 0);
+
+	printf("test_groups: passed\n");
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * test_hist.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the log-bucketed histogram: which bucket a value lands in
+ *  (0, 1, the powers of two and the top bucket), and the percentiles
+ *  estimated from the buckets - interpolated within a bucket, and never
+ *  above the largest value recorded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+
+#define TEST_NAME "test_hist"
+
+#include "test.h"
+
+/* The bucket a single value lands in */
+int bucket_of(unsigned long value)
+{
+	ut_hist_t hist;
+	int bucket;
+
+	memset(&hist, 0, sizeof(hist));
+	ut_hist_record(&hist, value);
+
+	CHECK(hist.count == 1);
+	CHECK(hist.sum == value);
+	CHECK(hist.max == value);
+
+	for (bucket = 0; bucket < UT_HIST_BUCKETS; ++bucket)
+	{
+		if (hist.buckets[bucket] != 0) return bucket;
+	}
+
+	return -1;
+}
+
+void check_buckets()
+{
+	int bits;
+
+	CHECK(bucket_of(0) == 0);
+	CHECK(bucket_of(1) == 1);
+
+	/* Bucket i holds [2^(i-1), 2^i - 1] */
+	for (bits = 1; bits < UT_HIST_BUCKETS - 1; ++bits)
+	{
+		CHECK(bucket_of(1UL << bits) == bits + 1);
+		CHECK(bucket_of((1UL << bits) - 1) == bits);
+	}
+
+	/* Anything wider goes to the top bucket */
+	CHECK(bucket_of(1UL << (UT_HIST_BUCKETS - 1)) == UT_HIST_BUCKETS - 1);
+	CHECK(bucket_of(ULONG_MAX) == UT_HIST_BUCKETS - 1);
+}
+
+void check_percentiles()
+{
+	ut_hist_t hist;
+	unsigned long value;
+	unsigned long previous = 0;
+	unsigned int percent;
+
+	/* Nothing recorded */
+	memset(&hist, 0, sizeof(hist));
+	CHECK(ut_hist_percentile(&hist, 50) == 0);
+	CHECK(ut_hist_percentile(NULL, 50) == 0);
+
+	/* Only zeros */
+	ut_hist_record(&hist, 0);
+	ut_hist_record(&hist, 0);
+	CHECK(ut_hist_percentile(&hist, 100) == 0);
+
+	/* Four values of the bucket [4, 7], spread over it */
+	memset(&hist, 0, sizeof(hist));
+	for (value = 4; value <= 7; ++value)
+	{
+		ut_hist_record(&hist, value);
+	}
+	CHECK(ut_hist_percentile(&hist, 25) == 4);
+	CHECK(ut_hist_percentile(&hist, 50) == 5);
+	CHECK(ut_hist_percentile(&hist, 75) == 6);
+	CHECK(ut_hist_percentile(&hist, 100) == 7);
+
+	/* A single value, not the top of its bucket */
+	memset(&hist, 0, sizeof(hist));
+	ut_hist_record(&hist, 4);
+	CHECK(ut_hist_percentile(&hist, 100) == 4);
+
+	/* Across buckets: half in [1, 1], half in [512, 1023] */
+	memset(&hist, 0, sizeof(hist));
+	for (value = 0; value < 100; ++value)
+	{
+		ut_hist_record(&hist, 1);
+		ut_hist_record(&hist, 1000);
+	}
+	CHECK(ut_hist_percentile(&hist, 50) == 1);
+	value = ut_hist_percentile(&hist, 75);
+	CHECK(value >= 512 && value <= 1000);
+	CHECK(ut_hist_percentile(&hist, 100) == 1000);
+
+	/* Never decreasing, within the values recorded */
+	memset(&hist, 0, sizeof(hist));
+	for (value = 1; value <= 1000; ++value)
+	{
+		ut_hist_record(&hist, value);
+	}
+	for (percent = 0; percent <= 100; ++percent)
+	{
+		value = ut_hist_percentile(&hist, percent);
+		CHECK(value >= previous && value <= 1000);
+		previous = value;
+	}
+
+	/* The top bucket has no upper bound but the largest value */
+	memset(&hist, 0, sizeof(hist));
+	ut_hist_record(&hist, 1UL << (UT_HIST_BUCKETS - 1));
+	ut_hist_record(&hist, ULONG_MAX);
+	value = ut_hist_percentile(&hist, 50);
+	CHECK(value >= 1UL << (UT_HIST_BUCKETS - 2));
+	CHECK(ut_hist_percentile(&hist, 100) == ULONG_MAX);
+}
+
+int main()
+{
+	check_buckets();
+	check_percentiles();
+
+	printf("test_hist: passed\n");
+	return 0;
+}
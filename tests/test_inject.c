@@ -0,0 +1,205 @@
+/*
+ * test_inject.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the injected threads. Threads injected before ut_start()
+ *  must run with the signal mask ut_start() ran with, like the spawned
+ *  threads, and so with the scheduler's and the profiler's signals
+ *  unblocked. A pthread injecting while the scheduler runs gets its
+ *  threads run, more of them than the table holds, and ut_start()
+ *  returns only once they all did. And a pthread wakes a parked thread,
+ *  a wake up before the park included. Each scenario runs in a child
+ *  process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+
+#define TEST_NAME "test_inject"
+
+#include "test.h"
+
+#define CHILD_TIMEOUT_MSEC (60000)
+#define NUM_INJECTED (4 * MAX_TAB_SIZE)
+#define PARK_ROUNDS (100)
+
+volatile int injected_ran = 0;
+volatile int injecting_done = 0;
+volatile int parks = -1;
+tid_t parker;
+
+/* The mask the calling thread runs with */
+void check_mask()
+{
+	sigset_t mask;
+
+	CHECK(sigprocmask(SIG_SETMASK, NULL, &mask) == 0);
+	CHECK(sigismember(&mask, SIGUSR1) == 1);
+	CHECK(sigismember(&mask, SIGALRM) == 0);
+	CHECK(sigismember(&mask, SIGVTALRM) == 0);
+}
+
+void injected(int arg)
+{
+	check_mask();
+	injected_ran = 1;
+}
+
+void spawned(int arg)
+{
+	check_mask();
+
+	while (!injected_ran)
+	{
+		ut_yield();
+	}
+
+	exit(0);
+}
+
+void mask(void *arg)
+{
+	sigset_t blocked;
+
+	/* Something the threads must inherit */
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGUSR1);
+	CHECK(sigprocmask(SIG_BLOCK, &blocked, NULL) == 0);
+
+	CHECK(ut_init(3) == 0);
+	CHECK(ut_inject_spawn(injected, 0) >= 0);
+	CHECK(ut_spawn_thread(spawned, 0) >= 0);
+
+	ut_start();
+	exit(1);
+}
+
+/* Other pthreads leave the scheduler's signals alone */
+void block_timers()
+{
+	sigset_t timers;
+
+	sigemptyset(&timers);
+	sigaddset(&timers, SIGALRM);
+	sigaddset(&timers, SIGVTALRM);
+	CHECK(pthread_sigmask(SIG_BLOCK, &timers, NULL) == 0);
+}
+
+void count_run(int arg)
+{
+	__sync_fetch_and_add(&injected_ran, 1);
+}
+
+void *inject_many(void *arg)
+{
+	int i;
+
+	block_timers();
+
+	for (i = 0; i < NUM_INJECTED; ++i)
+	{
+		/* The table or the queue is full, the scheduler makes room */
+		while (ut_inject_spawn(count_run, i) < 0)
+		{
+			usleep(100);
+		}
+	}
+
+	injecting_done = 1;
+	return NULL;
+}
+
+/* Keeps the scheduler running until the injector is done */
+void wait_injector(int arg)
+{
+	while (!injecting_done)
+	{
+		ut_sleep(1);
+	}
+}
+
+void from_pthread(void *arg)
+{
+	pthread_t injector;
+
+	CHECK(ut_init(MAX_TAB_SIZE) == 0);
+	CHECK(ut_spawn_thread(wait_injector, 0) >= 0);
+	CHECK(pthread_create(&injector, NULL, inject_many, NULL) == 0);
+
+	CHECK(ut_start() == 0);
+	CHECK(pthread_join(injector, NULL) == 0);
+
+	/* Every injected thread ran before ut_start() returned */
+	CHECK(injected_ran == NUM_INJECTED);
+	exit(0);
+}
+
+void park_often(int arg)
+{
+	int i;
+
+	/* A wake up of our own, kept for the first park */
+	CHECK(ut_inject_wake(ut_self()) == 0);
+	ut_park();
+	parks = 0;
+
+	for (i = 0; i < PARK_ROUNDS; ++i)
+	{
+		ut_park();
+		parks++;
+	}
+}
+
+void *wake_parker(void *arg)
+{
+	int i;
+
+	block_timers();
+
+	for (i = 0; i < PARK_ROUNDS; ++i)
+	{
+		/* One wake up per park, never two for the same one */
+		while (parks != i)
+		{
+			usleep(100);
+		}
+		CHECK(ut_inject_wake(parker) == 0);
+	}
+
+	return NULL;
+}
+
+void park(void *arg)
+{
+	pthread_t waker;
+
+	CHECK(ut_init(2) == 0);
+	parker = ut_spawn_thread(park_often, 0);
+	CHECK(parker >= 0);
+	CHECK(ut_inject_wake(SYS_ERR) == SYS_ERR);
+	CHECK(pthread_create(&waker, NULL, wake_parker, NULL) == 0);
+
+	CHECK(ut_start() == 0);
+	CHECK(pthread_join(waker, NULL) == 0);
+
+	CHECK(parks == PARK_ROUNDS);
+	exit(0);
+}
+
+int main()
+{
+	CHECK(test_run(mask, NULL, CHILD_TIMEOUT_MSEC) == 0);
+	CHECK(test_run(from_pthread, NULL, CHILD_TIMEOUT_MSEC) == 0);
+	CHECK(test_run(park, NULL, CHILD_TIMEOUT_MSEC) == 0);
+
+	printf("test_inject: passed\n");
+	return 0;
+}
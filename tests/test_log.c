@@ -0,0 +1,182 @@
+/*
+ * test_log.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of ut_log: the lines of several threads go through a small
+ *  non-blocking pipe, read slowly by a child process, so the drainer
+ *  runs into full pipes and short writes. Every line must arrive once
+ *  and in its thread's order, and ut_start() must return once the
+ *  logging threads are done. In a simulation, an idle drainer must
+ *  block rather than spin, or the clock never reaches a sleeper's
+ *  wake up.
+ */
+
+#define _GNU_SOURCE  /* F_SETPIPE_SZ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+#include "ut_log.h"
+
+#define TEST_NAME "test_log"
+
+#include "test.h"
+
+#define NUM_LOGGERS (4)
+#define LINES (2000)
+#define PIPE_SIZE (4096)
+#define SIM_ROUNDS (3)
+#define SIM_SLEEP_MSEC (5)
+#define TIMEOUT_MSEC (10000)
+
+void logger(int index)
+{
+	int line;
+
+	for (line = 0; line < LINES; ++line)
+	{
+		ut_log("logger %d line %d", index, line);
+
+		/* Slower than the reader, so no ring fills up */
+		if (line % 16 == 15)
+		{
+			ut_sleep(1);
+		}
+	}
+}
+
+/* Logs between sleeps */
+void sim_logger(int arg)
+{
+	unsigned long start = ut_now_ms();
+	int round;
+
+	for (round = 0; round < SIM_ROUNDS; ++round)
+	{
+		ut_log("round %d", round);
+		ut_sleep(SIM_SLEEP_MSEC);
+	}
+
+	CHECK(ut_now_ms() - start >= SIM_ROUNDS * SIM_SLEEP_MSEC);
+}
+
+void in_simulation(void *arg)
+{
+	int fd = open("/dev/null", O_WRONLY);
+
+	CHECK(fd >= 0);
+	CHECK(ut_init(2) == 0);
+	CHECK(ut_sim_enable(1) == 0);
+	CHECK(ut_spawn_thread(sim_logger, 0) >= 0);
+	CHECK(ut_log_init(fd) == 0);
+
+	CHECK(ut_start() == 0);
+	CHECK(ut_log_dropped() == 0);
+	exit(0);
+}
+
+/* The child, reads slowly until the writer closes the pipe */
+void slow_reader(int fd, int out)
+{
+	char buffer[1000];
+	ssize_t length;
+
+	while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+	{
+		if (write(out, buffer, length) != length) exit(1);
+		usleep(100);
+	}
+
+	exit(0);
+}
+
+void check_output(int out)
+{
+	int next[NUM_LOGGERS] = { 0 };
+	char text[256];
+	FILE *pFile;
+	int total = 0;
+
+	CHECK(lseek(out, 0, SEEK_SET) == 0);
+	pFile = fdopen(out, "r");
+	CHECK(pFile != NULL);
+
+	while (fgets(text, sizeof(text), pFile) != NULL)
+	{
+		int tid, index, line;
+
+		CHECK(sscanf(text, "[%*s (%d) logger %d line %d",
+					 &tid, &index, &line) == 3);
+		CHECK(index >= 0 && index < NUM_LOGGERS);
+
+		/* Once, and in order */
+		CHECK(line == next[index]);
+		next[index]++;
+		total++;
+	}
+
+	fclose(pFile);
+
+	CHECK(total == NUM_LOGGERS * LINES);
+}
+
+int main()
+{
+	char path[] = "/tmp/test_log.XXXXXX";
+	int fds[2];
+	int out;
+	pid_t reader;
+	int status;
+	int i;
+
+	CHECK(test_run(in_simulation, NULL, TIMEOUT_MSEC) == 0);
+
+	/* What the reader got, gone once closed */
+	out = mkstemp(path);
+	CHECK(out >= 0);
+	unlink(path);
+
+	CHECK(pipe(fds) == 0);
+	reader = fork();
+	CHECK(reader >= 0);
+
+	if (reader == 0)
+	{
+		close(fds[1]);
+		slow_reader(fds[0], out);
+	}
+	close(fds[0]);
+
+	/* Small and non-blocking, so writes fall short */
+	fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+	CHECK(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+	CHECK(ut_init(NUM_LOGGERS + 1) == 0);
+	for (i = 0; i < NUM_LOGGERS; ++i)
+	{
+		CHECK(ut_spawn_thread(logger, i) >= 0);
+	}
+	CHECK(ut_log_init(fds[1]) == 0);
+
+	/* Returns once the loggers and the drainer are done */
+	CHECK(ut_start() == 0);
+	CHECK(ut_num_live_threads() == 0);
+	CHECK(ut_log_dropped() == 0);
+
+	close(fds[1]);
+	CHECK(waitpid(reader, &status, 0) == reader);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	check_output(out);
+
+	printf("test_log: passed\n");
+	return 0;
+}
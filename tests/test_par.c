@@ -0,0 +1,193 @@
+/*
+ * test_par.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the parallel loops, with far more chunks than the task
+ *  queue holds: they must finish, visit every iteration once, combine
+ *  the chunks in the range's order, and take memory only for what is
+ *  in flight rather than for every chunk. Ranges at the ends of long,
+ *  and wider than the largest long, must be split without overflowing.
+ *  And a latch must open once counted down by tasks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include "ut.h"
+#include "ut_par.h"
+#include "ut_task.h"
+
+#define TEST_NAME "test_par"
+
+#include "test.h"
+
+#define NUM_WORKERS (4)
+#define REDUCE_SIZE (2000000L)     /* Chunks of one, ~500 times the queue */
+#define FOR_SIZE (100000L)
+#define MAX_GROWTH_BYTES (8L << 20)
+#define EMPTY (-1L)
+#define NUM_LATCH_TASKS (100)
+
+/* A reduced value is the range it covers, [low, high) */
+#define RANGE(low, high) (((long)(low) << 32) | (high))
+#define LOW(range) ((range) >> 32)
+#define HIGH(range) ((range) & 0xffffffffL)
+
+char visits[FOR_SIZE];
+volatile int out_of_order = 0;
+
+/* Resident memory, in bytes */
+long rss_bytes()
+{
+	char buffer[128];
+	long pages = 0;
+	int fd = open("/proc/self/statm", O_RDONLY);
+
+	if (fd >= 0)
+	{
+		ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+
+		if (length > 0)
+		{
+			buffer[length] = '\0';
+			if (sscanf(buffer, "%*s %ld", &pages) != 1) pages = 0;
+		}
+		close(fd);
+	}
+
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+long sum_chunk(long begin, long end, void *ctx)
+{
+	long sum = 0;
+	long i;
+
+	for (i = begin; i < end; ++i)
+	{
+		sum += i;
+	}
+
+	return sum;
+}
+
+long add(long a, long b, void *ctx)
+{
+	return a + b;
+}
+
+long range_chunk(long begin, long end, void *ctx)
+{
+	return RANGE(begin, end);
+}
+
+/* Associative but not commutative - ranges must meet */
+long join_ranges(long a, long b, void *ctx)
+{
+	if (a == EMPTY) return b;
+	if (b == EMPTY) return a;
+
+	if (HIGH(a) != LOW(b))
+	{
+		out_of_order = 1;
+	}
+
+	return RANGE(LOW(a), HIGH(b));
+}
+
+/* Counts the chunks, and the iterations they cover */
+long count_chunk(long begin, long end, void *ctx)
+{
+	unsigned long *pIterations = ctx;
+
+	__sync_fetch_and_add(pIterations, (unsigned long)end - (unsigned long)begin);
+
+	return 1;
+}
+
+void *count_down(void *ctx)
+{
+	ut_latch_count_down(ctx);
+	return NULL;
+}
+
+void visit_chunk(long begin, long end, void *ctx)
+{
+	long i;
+
+	for (i = begin; i < end; ++i)
+	{
+		visits[i]++;
+	}
+}
+
+void driver(int arg)
+{
+	long rss_before = rss_bytes();
+	unsigned long iterations;
+	ut_latch_t latch;
+	long i;
+
+	/* Used to hang once the queue was full */
+	CHECK(ut_parallel_reduce(0, REDUCE_SIZE, 1, 0, sum_chunk, add, NULL) ==
+		  REDUCE_SIZE * (REDUCE_SIZE - 1) / 2);
+	CHECK(rss_bytes() - rss_before < MAX_GROWTH_BYTES);
+
+	/* Whoever ran the chunks, they're combined in order */
+	CHECK(ut_parallel_reduce(0, REDUCE_SIZE, 1, EMPTY, range_chunk,
+							 join_ranges, NULL) == RANGE(0, REDUCE_SIZE));
+	CHECK(ut_parallel_reduce(5, FOR_SIZE, 7, EMPTY, range_chunk,
+							 join_ranges, NULL) == RANGE(5, FOR_SIZE));
+	CHECK(!out_of_order);
+
+	/* Every iteration once, also with a last partial chunk */
+	ut_parallel_for(0, FOR_SIZE, 1, visit_chunk, NULL);
+	ut_parallel_for(0, FOR_SIZE, 7, visit_chunk, NULL);
+	for (i = 0; i < FOR_SIZE; ++i)
+	{
+		CHECK(visits[i] == 2);
+	}
+
+	/* begin + grain is past the largest long */
+	iterations = 0;
+	CHECK(ut_parallel_reduce(LONG_MAX - 10, LONG_MAX, 7, 0, count_chunk,
+							 add, &iterations) == 2);
+	CHECK(iterations == 10);
+
+	/* Wider than the largest long, a grain close to it */
+	iterations = 0;
+	CHECK(ut_parallel_reduce(LONG_MIN, LONG_MAX, LONG_MAX, 0, count_chunk,
+							 add, &iterations) == 3);
+	CHECK(iterations == ULONG_MAX);
+	CHECK(ut_parallel_reduce(LONG_MIN, LONG_MAX, LONG_MAX - 1, 0, count_chunk,
+							 add, &iterations) == 3);
+
+	/* Tasks count a latch down */
+	ut_latch_init(&latch, NUM_LATCH_TASKS);
+	for (i = 0; i < NUM_LATCH_TASKS; ++i)
+	{
+		CHECK(ut_task_post(count_down, &latch) == 0);
+	}
+	ut_latch_wait(&latch);
+	CHECK(latch.count == 0);
+
+	printf("test_par: passed\n");
+	exit(0);
+}
+
+int main()
+{
+	CHECK(ut_init(NUM_WORKERS + 1) == 0);
+	CHECK(ut_task_pool_init(NUM_WORKERS) == 0);
+	CHECK(ut_spawn_thread(driver, 0) >= 0);
+
+	ut_start();
+
+	printf("test_par: the threads never finished\n");
+	return 1;
+}
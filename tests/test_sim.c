@@ -0,0 +1,182 @@
+/*
+ * test_sim.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the simulation mode. Threads contend on a semaphore,
+ *  work and sleep for pseudo-random times, and trace who entered the
+ *  critical section when. Two runs with the same seed must produce
+ *  the very same trace, and a run with another seed a different one.
+ *  A simulation where every thread is blocked must stop with an error
+ *  instead of spinning. Each run is a child process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binsem.h"
+#include "ut.h"
+#include "ut_sched.h"
+
+#define TEST_NAME "test_sim"
+
+#include "test.h"
+
+#define NUM_WORKERS (4)
+#define ROUNDS (200)
+#define MAX_TRACE (NUM_WORKERS * ROUNDS)
+#define CHILD_TIMEOUT_MSEC (10000)
+#define SLICE_MIN_USEC (1000)
+#define SLICE_MAX_USEC (5000)
+
+typedef struct _trace_entry {
+	int tid;
+	unsigned long now_ms;
+} trace_entry_t;
+
+sem_t mutex;
+sem_t never;
+trace_entry_t trace[MAX_TRACE];
+int trace_len = 0;
+int workers_left = NUM_WORKERS;
+int trace_fd;
+
+void worker(int index)
+{
+	unsigned int seed = index + 1;
+	int round;
+
+	for (round = 0; round < ROUNDS; ++round)
+	{
+		int points;
+
+		/* Some work outside */
+		seed = seed * 1103515245 + 12345;
+		for (points = (seed >> 16) % 5; points > 0; --points)
+		{
+			ut_sim_point();
+		}
+
+		binsem_down(&mutex);
+		trace[trace_len].tid = ut_self();
+		trace[trace_len].now_ms = ut_now_ms();
+		trace_len++;
+		ut_sim_point();
+		binsem_up(&mutex);
+
+		if (seed % 7 == 0)
+		{
+			ut_sleep(seed % 5);
+		}
+	}
+
+	/* The last one hands the trace over */
+	if (--workers_left == 0)
+	{
+		ssize_t size = trace_len * sizeof(trace_entry_t);
+		exit(write(trace_fd, trace, size) == size ? 0 : 1);
+	}
+}
+
+void deadlocked(int index)
+{
+	binsem_down(&never);
+}
+
+/* A simulation to run */
+typedef struct _sim_args {
+	unsigned long seed;
+	int deadlock;
+} sim_args_t;
+
+/* Runs in a child, never returns */
+void simulate(void *arg)
+{
+	sim_args_t *pArgs = arg;
+	int i;
+
+	binsem_init(&mutex, 1);
+	binsem_init(&never, 0);
+
+	/* Short quanta, so the threads are preempted a lot */
+	if (ut_init(NUM_WORKERS) != 0 || ut_sim_enable(pArgs->seed) != 0 ||
+		ut_set_adaptive_slices(SLICE_MIN_USEC, SLICE_MAX_USEC) != 0)
+	{
+		exit(1);
+	}
+
+	for (i = 0; i < NUM_WORKERS; ++i)
+	{
+		ut_spawn_thread(pArgs->deadlock ? deadlocked : worker, i);
+	}
+
+	ut_start();
+	exit(1);
+}
+
+/* Runs a simulation in a child process, returns its exit status
+ * and fills the trace it wrote.
+ */
+int run(unsigned long seed, int deadlock, trace_entry_t *pTrace, int *pLen)
+{
+	sim_args_t args;
+	int fds[2];
+	int status;
+	ssize_t got = 0;
+
+	args.seed = seed;
+	args.deadlock = deadlock;
+
+	/* The trace fits in the pipe, it's read once the child is done */
+	CHECK(pipe(fds) == 0);
+	trace_fd = fds[1];
+	status = test_run(simulate, &args, CHILD_TIMEOUT_MSEC);
+	close(fds[1]);
+
+	if (pTrace != NULL)
+	{
+		ssize_t length;
+
+		while ((length = read(fds[0], (char *)pTrace + got,
+							  MAX_TRACE * sizeof(trace_entry_t) - got)) > 0)
+		{
+			got += length;
+		}
+		*pLen = got / sizeof(trace_entry_t);
+	}
+	close(fds[0]);
+
+	return status;
+}
+
+int main()
+{
+	static trace_entry_t first[MAX_TRACE];
+	static trace_entry_t second[MAX_TRACE];
+	static trace_entry_t other[MAX_TRACE];
+	int first_len, second_len, other_len;
+
+	CHECK(run(7, 0, first, &first_len) == 0);
+	CHECK(run(7, 0, second, &second_len) == 0);
+	CHECK(run(8, 0, other, &other_len) == 0);
+
+	/* Everyone got in every round */
+	CHECK(first_len == MAX_TRACE);
+	CHECK(second_len == MAX_TRACE);
+	CHECK(other_len == MAX_TRACE);
+
+	/* Same seed, same interleaving and virtual times */
+	CHECK(memcmp(first, second, sizeof(first)) == 0);
+
+	/* And the seed does matter */
+	CHECK(memcmp(first, other, sizeof(first)) != 0);
+
+	/* Nobody can ever wake up, must not spin */
+	CHECK(run(7, 1, NULL, NULL) == 1);
+
+	printf("test_sim: passed\n");
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * test_slices.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the adaptive time slices. Two CPU-bound threads take turns,
+ *  and one of them times its own slices - a gap in its clock readings
+ *  is the other's turn. Its slices must grow to the longest quantum
+ *  while it spins, shrink to the shortest once it has run in short
+ *  bursts, grow back when it spins again, and always stay within the
+ *  bounds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+#include "ut_stats.h"
+
+#define TEST_NAME "test_slices"
+
+#include "test.h"
+
+#define SLICE_MIN_USEC (2000)
+#define SLICE_MAX_USEC (20000)
+#define SLACK_USEC (2000)        /* Signal delivery, a busy machine */
+#define GAP_USEC (SLICE_MIN_USEC / 2)
+#define SLICES (12)
+#define GROWN_SLICES (4)         /* The last ones, at the longest quantum */
+#define BURSTS (40)
+#define BURST_USEC (100)
+
+volatile int done = 0;
+
+/* Spins for a number of slices, and records their lengths */
+void time_slices(unsigned long *lengths, int count)
+{
+	unsigned long start = ut_stats_now_us();
+	unsigned long last = start;
+	int slice = 0;
+
+	while (slice < count)
+	{
+		unsigned long now = ut_stats_now_us();
+
+		/* Was switched out, the slice ended at the last reading */
+		if (now - last > GAP_USEC)
+		{
+			lengths[slice++] = last - start;
+			start = now;
+		}
+
+		last = now;
+	}
+}
+
+void print_slices(const char *phase, unsigned long *lengths)
+{
+	int slice;
+
+	printf("test_slices: %s:", phase);
+	for (slice = 0; slice < SLICES; ++slice)
+	{
+		printf(" %lu", lengths[slice] / 1000);
+	}
+	printf(" ms\n");
+}
+
+void check_bounds(unsigned long *lengths)
+{
+	int slice;
+
+	for (slice = 0; slice < SLICES; ++slice)
+	{
+		CHECK(lengths[slice] <= SLICE_MAX_USEC + SLACK_USEC);
+	}
+}
+
+/* Grown to the longest quantum, to within a tick. The system may
+ * switch our process out too, which splits a slice in two.
+ */
+void check_grown(unsigned long *lengths)
+{
+	unsigned long longest = 0;
+	int slice;
+
+	for (slice = SLICES - GROWN_SLICES; slice < SLICES; ++slice)
+	{
+		if (lengths[slice] > longest) longest = lengths[slice];
+	}
+
+	CHECK(longest >= SLICE_MAX_USEC - SLICE_MIN_USEC - SLACK_USEC);
+}
+
+void observed(int arg)
+{
+	unsigned long spinning[SLICES];
+	unsigned long after_bursts[SLICES];
+	int burst;
+
+	/* From the shortest quantum up */
+	time_slices(spinning, SLICES);
+	print_slices("spinning", spinning);
+	CHECK(spinning[0] <= SLICE_MIN_USEC + SLACK_USEC);
+	check_grown(spinning);
+	check_bounds(spinning);
+
+	/* Short bursts bring the average down */
+	for (burst = 0; burst < BURSTS; ++burst)
+	{
+		unsigned long start = ut_stats_now_us();
+
+		while (ut_stats_now_us() - start < BURST_USEC);
+		ut_sleep(1);
+	}
+
+	/* Back to the shortest quantum, and up again */
+	time_slices(after_bursts, SLICES);
+	print_slices("after bursts", after_bursts);
+	CHECK(after_bursts[0] <= SLICE_MIN_USEC + SLACK_USEC);
+	check_grown(after_bursts);
+	check_bounds(after_bursts);
+
+	done = 1;
+}
+
+void spinner(int arg)
+{
+	while (!done);
+}
+
+int main()
+{
+	CHECK(ut_init(2) == 0);
+	CHECK(ut_set_adaptive_slices(SLICE_MAX_USEC, SLICE_MIN_USEC) == SYS_ERR);
+	CHECK(ut_set_adaptive_slices(SLICE_MIN_USEC, SLICE_MAX_USEC) == 0);
+	CHECK(ut_spawn_thread(observed, 0) >= 0);
+	CHECK(ut_spawn_thread(spinner, 0) >= 0);
+
+	CHECK(ut_start() == 0);
+
+	printf("test_slices: passed\n");
+	return 0;
+}
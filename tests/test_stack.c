@@ -0,0 +1,232 @@
+/*
+ * test_stack.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the stack high-water mark: only stacks allocated after
+ *  ut_enable_stack_hwm() are measured. And of the threads' stack use:
+ *  threads yielding and blocking on a semaphore, with the smallest
+ *  stacks, must only hold their own frames - the scheduler's run on
+ *  its own stack. Must be linked with -z now, or the dynamic linker's
+ *  first calls land on the threads' stacks. And the report printed at
+ *  exit must fit in the stack of the thread which exits. Each scenario
+ *  runs in a child process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binsem.h"
+#include "ut.h"
+#include "ut_sched.h"
+
+#define TEST_NAME "test_stack"
+
+#include "test.h"
+
+#define NUM_CONTENDERS (8)
+#define ROUNDS (200)
+#define YIELDS (10000)
+#define MAX_USED_BYTES (1024)     /* Of a thread's own frames */
+
+tid_t unpainted;
+tid_t painted;
+tid_t yielder;
+tid_t contenders[NUM_CONTENDERS];
+sem_t mutex;
+volatile int small_left = NUM_CONTENDERS + 1;
+
+void idle(int arg)
+{
+}
+
+void check(int arg)
+{
+	long used;
+
+	/* Spawned before the measurement was on */
+	CHECK(ut_get_stack_hwm(unpainted) == SYS_ERR);
+
+	used = ut_get_stack_hwm(painted);
+	CHECK(used > 0 && used < STACKSIZE);
+
+	/* Not a thread */
+	CHECK(ut_get_stack_hwm(SYS_ERR) == SYS_ERR);
+	CHECK(ut_get_stack_hwm(painted + 1) == SYS_ERR);
+
+	exit(0);
+}
+
+void yield_often(int arg)
+{
+	int i;
+
+	for (i = 0; i < YIELDS; ++i)
+	{
+		ut_yield();
+	}
+
+	small_left--;
+}
+
+/* Blocks, and is switched out inside the critical section */
+void contend(int arg)
+{
+	volatile int spin;
+	int round;
+
+	for (round = 0; round < ROUNDS; ++round)
+	{
+		binsem_down(&mutex);
+		for (spin = 0; spin < 10000; ++spin);
+		ut_yield();
+		binsem_up(&mutex);
+	}
+
+	small_left--;
+}
+
+/* The scheduler's frames never landed on the small stacks */
+void check_small(int arg)
+{
+	long used;
+	int i;
+
+	while (small_left > 0)
+	{
+		ut_yield();
+	}
+
+	used = ut_get_stack_hwm(yielder);
+	printf("test_stack: a yielding thread used %ld bytes\n", used);
+	CHECK(used > 0 && used < MAX_USED_BYTES);
+
+	for (i = 0; i < NUM_CONTENDERS; ++i)
+	{
+		used = ut_get_stack_hwm(contenders[i]);
+		CHECK(used > 0 && used < MAX_USED_BYTES);
+	}
+
+	exit(0);
+}
+
+void measurement(void *arg)
+{
+	CHECK(ut_init(2) == 0);
+
+	unpainted = ut_spawn_thread(idle, 0);
+	ut_enable_stack_hwm();
+	painted = ut_spawn_thread(check, 0);
+	CHECK(unpainted >= 0 && painted >= 0);
+
+	ut_start();
+	exit(1);
+}
+
+void small_stacks(void *arg)
+{
+	int i;
+
+	CHECK(ut_init(NUM_CONTENDERS + 2) == 0);
+	binsem_init(&mutex, 1);
+	ut_enable_stack_hwm();
+
+	/* The smallest stacks allowed. They run first, so the
+	 * library's first calls are made on them.
+	 */
+	CHECK(ut_set_stack_size(UT_MIN_STACKSIZE - 1) == SYS_ERR);
+	CHECK(ut_set_stack_size(UT_MIN_STACKSIZE) == 0);
+
+	yielder = ut_spawn_thread(yield_often, 0);
+	CHECK(yielder >= 0);
+	for (i = 0; i < NUM_CONTENDERS; ++i)
+	{
+		contenders[i] = ut_spawn_thread(contend, i);
+		CHECK(contenders[i] >= 0);
+	}
+
+	/* The checks print, they get a regular stack */
+	CHECK(ut_set_stack_size(STACKSIZE) == 0);
+	CHECK(ut_spawn_thread(check_small, 0) >= 0);
+
+	ut_start();
+	exit(1);
+}
+
+/* Exits once its neighbour is done */
+void exiter(int arg)
+{
+	ut_yield();
+	exit(0);
+}
+
+/* Three small stacks side by side, the middle one exits */
+void report_on_exit(void *arg)
+{
+	int fd = *(int *)arg;
+
+	CHECK(dup2(fd, STDERR_FILENO) == STDERR_FILENO);
+	CHECK(ut_init(3) == 0);
+	ut_enable_stack_hwm();
+	CHECK(ut_set_stack_size(UT_MIN_STACKSIZE) == 0);
+
+	CHECK(ut_spawn_thread(idle, 0) >= 0);
+	CHECK(ut_spawn_thread(exiter, 0) >= 0);
+	CHECK(ut_spawn_thread(idle, 0) >= 0);
+
+	ut_start();
+	exit(1);
+}
+
+/* Checks what the exiting thread reported */
+void check_report(int fd)
+{
+	char text[1024];
+	char *pLine = text;
+	ssize_t length;
+	int lines = 0;
+
+	CHECK(lseek(fd, 0, SEEK_SET) == 0);
+	length = read(fd, text, sizeof(text) - 1);
+	CHECK(length > 0);
+	text[length] = '\0';
+
+	while ((pLine = strstr(pLine, "Thread (")) != NULL)
+	{
+		int tid;
+		long used, size;
+
+		CHECK(sscanf(pLine, "Thread (%d) used %ld of %ld", &tid, &used, &size) == 3);
+		CHECK(size == UT_MIN_STACKSIZE);
+
+		/* Its neighbours hardly ran, nothing spilled into them */
+		CHECK(used > 0 && (tid == 1 ? used < size : used < MAX_USED_BYTES));
+
+		lines++;
+		pLine++;
+	}
+
+	CHECK(lines == 3);
+}
+
+int main()
+{
+	char path[] = "/tmp/test_stack.XXXXXX";
+	int fd;
+
+	CHECK(test_run(measurement, NULL, 0) == 0);
+	CHECK(test_run(small_stacks, NULL, 0) == 0);
+
+	fd = mkstemp(path);
+	CHECK(fd >= 0);
+	unlink(path);
+	CHECK(test_run(report_on_exit, &fd, 0) == 0);
+	check_report(fd);
+	close(fd);
+
+	printf("test_stack: passed\n");
+	return 0;
+}
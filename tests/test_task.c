@@ -0,0 +1,100 @@
+/*
+ * test_task.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Tests of the task pool's idle threads: idle workers and threads
+ *  waiting for a future must block rather than spin. In a simulation,
+ *  spinning threads would keep the clock from reaching any sleeper's
+ *  wake up; outside of one, they would burn the CPU.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ut.h"
+#include "ut_sched.h"
+#include "ut_task.h"
+
+#define TEST_NAME "test_task"
+
+#include "test.h"
+
+#define NUM_WORKERS (4)
+#define TASK_SLEEP_MSEC (5)
+#define IDLE_MSEC (300)
+#define MAX_IDLE_CPU_MSEC (30)
+#define TIMEOUT_MSEC (10000)
+
+void *sleepy_task(void *ctx)
+{
+	ut_sleep(TASK_SLEEP_MSEC);
+	return ctx;
+}
+
+/* Waits for a sleeping task and sleeps among idle workers */
+void sim_driver(int arg)
+{
+	unsigned long start = ut_now_ms();
+
+	CHECK(ut_future_get(ut_task_submit(sleepy_task, (void *)7L)) == (void *)7L);
+	CHECK(ut_now_ms() - start >= TASK_SLEEP_MSEC);
+
+	ut_sleep(IDLE_MSEC);
+	CHECK(ut_now_ms() - start >= TASK_SLEEP_MSEC + IDLE_MSEC);
+
+	exit(0);
+}
+
+void in_simulation(void *arg)
+{
+	CHECK(ut_init(NUM_WORKERS + 1) == 0);
+	CHECK(ut_sim_enable(1) == 0);
+	CHECK(ut_task_pool_init(NUM_WORKERS) == 0);
+	CHECK(ut_spawn_thread(sim_driver, 0) >= 0);
+
+	ut_start();
+}
+
+/* Measures the CPU time of an idle pool */
+void idle_driver(int arg)
+{
+	clock_t start;
+	long cpu_msec;
+
+	/* The workers went idle */
+	ut_sleep(10);
+
+	start = clock();
+	ut_sleep(IDLE_MSEC);
+	cpu_msec = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+	printf("test_task: an idle pool took %ld ms of CPU in %d ms\n",
+		   cpu_msec, IDLE_MSEC);
+	CHECK(cpu_msec < MAX_IDLE_CPU_MSEC);
+
+	/* And still runs tasks */
+	CHECK(ut_future_get(ut_task_submit(sleepy_task, (void *)8L)) == (void *)8L);
+
+	exit(0);
+}
+
+void idle_pool(void *arg)
+{
+	CHECK(ut_init(NUM_WORKERS + 1) == 0);
+	CHECK(ut_task_pool_init(NUM_WORKERS) == 0);
+	CHECK(ut_spawn_thread(idle_driver, 0) >= 0);
+
+	ut_start();
+}
+
+int main()
+{
+	CHECK(test_run(in_simulation, NULL, TIMEOUT_MSEC) == 0);
+	CHECK(test_run(idle_pool, NULL, TIMEOUT_MSEC) == 0);
+
+	printf("test_task: passed\n");
+	return 0;
+}
@@ -5,26 +5,165 @@
  *      Author: Or Dahan 201644929
  */
 
+#define _GNU_SOURCE  /* REG_RSP & REG_ESP, of the saved contexts */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 
 #include "ut.h"
+#include "ut_sched.h"
+#include "ut_alloc.h"
+#include "ut_stats.h"
 
 /* Internal definitions */
 #define QUANTOM_SEC (1)
 #define PROFILER_INTERVAL_MSEC (10)
 #define PROFILER_INTERVAL_USEC (PROFILER_INTERVAL_MSEC * 1000)
+#define STACK_CANARY (0xA5)
+#define SIM_POINT_MSEC (1) /* Virtual CPU time of a single preemption point */
+#define IDLE_SLEEP_MSEC (1)
+#define QUANTOM_USEC (QUANTOM_SEC * 1000000UL)
+#define BURST_EWMA_SHIFT (2) /* A new burst weighs 1/4 of the average */
+#define SCHED_STACK_SIZE (64 * 1024)
+#ifdef __x86_64__
+#define SCHED_RED_ZONE (128) /* May be in use below the saved stack pointer */
+#else
+#define SCHED_RED_ZONE (0)
+#endif
 
 typedef void (*thread_main)(int);
 
+/* Thread states */
+#define THREAD_READY (0)
+#define THREAD_FINISHED (1)
+#define THREAD_SLEEPING (2)
+#define THREAD_BLOCKED (3)
+
+#define NO_GROUP (-1)
+
+/* Injected requests */
+#define INJECT_NOP (0)
+#define INJECT_SPAWN (1)
+#define INJECT_WAKE (2)
+#define INJECT_MASK (UT_INJECT_QUEUE_SIZE - 1)
+#define FREE_SLOTS_MASK (MAX_TAB_SIZE - 1)
+
+/* Per-thread data that doesn't fit in ut_slot_t
+ * (ut.h can't be changed). Indexed by slot, like s_threads.
+ */
+typedef struct _ut_thread_info {
+	int state;
+	unsigned long switches;  /* Times the thread was switched in */
+	unsigned long wake_ms;   /* When a sleeping thread becomes ready */
+	void *wait_obj;          /* What a blocked (or timed) waiter waits for */
+	unsigned long wait_ticket; /* Keeps the waiters in FIFO order */
+	int granted;             /* Woken as the new owner of wait_obj */
+	unsigned long ready_at_us;    /* When it last became ready */
+	unsigned long slice_start_us; /* When it last got the CPU */
+	unsigned long slice_us;  /* Length of its current quantum */
+	unsigned long burst_start_us; /* Same, on the scheduler's clock */
+	unsigned long burst_us;  /* Average CPU burst (EWMA) */
+	int group;               /* Charged for its CPU time, NO_GROUP if none */
+	volatile int published;  /* Slot is set up, counted as spawned */
+	volatile int park_permit; /* A wake up for ut_park() */
+	int mapped;              /* Stack was mmap()ed, freed once it finishes */
+	unsigned long stack_size;
+	int painted;             /* Stack was filled with the canary */
+	char *pSigFrames;        /* Its handlers' frames, while switched out */
+	unsigned long sig_frames_size;
+	ut_sched_stats_t sched_stats;
+} ut_thread_info_t;
+
+/* A cell of the injection queue (bounded MPSC) */
+typedef struct _inject_cell {
+	volatile unsigned long seq;
+	int type;
+	tid_t tid;
+	thread_main func;
+	int arg;
+} inject_cell_t;
+
+/* A cell of the free slots list (bounded, one producer) */
+typedef struct _free_slot_cell {
+	volatile unsigned long seq;
+	unsigned int slot;
+} free_slot_cell_t;
+
+/* A group of threads sharing a CPU quota */
+typedef struct _ut_group {
+	unsigned long period_us;       /* 0 - no quota */
+	unsigned long budget_us;       /* CPU time allowed per period */
+	unsigned long used_us;         /* CPU time charged in this period */
+	unsigned long period_start_us; /* Start of the current period */
+	tid_t last_throttled;          /* Yields to a mate once after the refill */
+} ut_group_t;
+
 /* Global structures */
 static ut_slot s_threads;
+static ut_thread_info_t s_threads_info[MAX_TAB_SIZE + 1];
 static unsigned int s_threads_size = 0;
 static unsigned int s_num_spawned_threads = 0;
+static volatile unsigned int s_num_reserved_threads = 0;
+static unsigned int s_num_finished_threads = 0;
 static tid_t s_current_thread_id = 0;
+static int s_started = 0;
+static int s_stack_hwm_enabled = 0;
+static unsigned long s_stack_size = STACKSIZE;
+static sigset_t s_thread_sigmask; /* What ut_start() ran with, for injected threads */
+
+/* The signal handlers run on an alternate stack, and a
+ * dedicated context moves the frames on it between threads.
+ */
+static char *s_sig_stack = NULL;
+static char *s_switch_stack = NULL;
+static ucontext_t s_switch_context;
+static tid_t s_switch_from = 0;
+static tid_t s_switch_to = 0;
+
+/* Adaptive time slices, 0 - a fixed quantum */
+static unsigned long s_min_slice_us = 0;
+static unsigned long s_max_slice_us = 0;
+static unsigned long s_tick_us = 0;           /* Period of the slices' timer */
+static volatile unsigned long s_ticks_left = 0; /* Of the current quantum */
+
+/* Critical sections & semaphore handoff */
+static volatile int s_preempt_disabled = 0;
+static volatile int s_resched_pending = 0;
+static int s_handoff_enabled = 0;
+static tid_t s_handoff_target = SYS_ERR;
+static unsigned long s_next_wait_ticket = 0;
+
+/* Requests from outside the threads (pthreads, signal handlers) */
+static inject_cell_t s_inject_queue[UT_INJECT_QUEUE_SIZE];
+static volatile unsigned long s_inject_head = 0;
+static volatile unsigned long s_inject_tail = 0;
+
+/* Slots of finished injected threads, taken by the next ones */
+static free_slot_cell_t s_free_slots[MAX_TAB_SIZE];
+static volatile unsigned long s_free_head = 0;
+static unsigned long s_free_tail = 0;
+
+/* Thread groups & their CPU quotas */
+static ut_group_t s_groups[UT_MAX_GROUPS];
+static int s_num_groups = 0;
+
+/* Scheduler health metrics */
+static ut_sched_stats_t s_sched_stats;
+static unsigned long long s_switch_start_cycles = 0;
+
+/* Simulation mode - virtual clock, seeded preemption points */
+static int s_sim_enabled = 0;
+static unsigned long s_sim_now_ms = 0;
+static unsigned long s_sim_random = 0;
+static unsigned long s_sim_budget = 0;
 
 /* Internal functions */
 
@@ -45,12 +184,240 @@ void set_num_threads_in_valid_range(int tab_size);
  */
 void scheduler(int signal);
 
+/**
+ * Handles SIGALRM. With adaptive slices, the timer ticks
+ * periodically and a tick only counts the quantum down;
+ * its end (or ut_yield()) runs the scheduler.
+ */
+void scheduler_tick(int signal, siginfo_t *pSigInfo, void *pContext);
+
+/**
+ * Body of the switching context. Saves the alternate stack's
+ * frames of the outgoing thread, puts back those of the
+ * incoming one (if it was switched out before) and resumes it.
+ * Restarts from the top on every switch.
+ */
+void switch_threads();
+
+/**
+ * Returns the bottom of the frames a context saved by the
+ * scheduler has on the alternate stack, from its stack pointer.
+ * Without a known stack pointer register, the whole stack.
+ */
+char *sig_frames_low(ucontext_t *pContext);
+
+/**
+ * Picks the next thread to run, round-robin after the
+ * current one. Wakes sleeping threads whose time has come,
+ * skips the threads of throttled groups, and waits for one
+ * if no thread is ready. Exits the process if none ever can be.
+ * @return TID of the next thread
+ */
+tid_t pick_next_thread();
+
+/**
+ * Blocks the current thread on an object until it's woken, for
+ * ut_wait(), ut_wait_again() & ut_wait_timeout(). Sleeping, the
+ * scheduler also wakes it at its wake_ms.
+ * @param state THREAD_BLOCKED or THREAD_SLEEPING
+ * @param keep_ticket Non-zero to wait in the place of the last wait
+ * @return 1 - Granted the object
+ * 		   0 - Woken (or timed out)
+ */
+int wait_on(void *obj, int state, int keep_ticket);
+
+/**
+ * Reserves the next slot of the table, lock-free.
+ * @return The slot - Success
+ * 		   TAB_FULL - No room in the table
+ */
+int reserve_slot();
+
+/**
+ * Sets up a reserved slot to run the given function
+ * (everything but the context's entry point).
+ * @return 0 - Success
+ * 		   SYS_ERR - On any failure
+ */
+int setup_slot(unsigned int slot, thread_main main, int arg,
+			   void *pStack, unsigned long stack_size);
+
+/**
+ * Marks a slot which couldn't be set up as a finished thread.
+ */
+void retire_slot(unsigned int slot);
+
+/**
+ * Counts the set up slots as spawned threads, in order,
+ * up to the first slot still being set up.
+ */
+void publish_slots();
+
+/**
+ * Takes a slot freed by a finished injected thread.
+ * Lock-free and async-signal-safe.
+ * @return The slot - Success
+ * 		   TAB_FULL - No slot was freed
+ */
+int take_free_slot();
+
+/**
+ * Unmaps the stacks of the finished injected threads, and puts
+ * their slots in the free slots list. Runs in the scheduler only.
+ */
+void recycle_slots();
+
+/**
+ * Puts a request in the injection queue.
+ * Lock-free and async-signal-safe.
+ * @param type Request type
+ * @param tid The thread to wake (INJECT_WAKE)
+ * @param func,arg The thread to spawn (INJECT_SPAWN)
+ * @return 0 or the spawned TID - Success
+ * 		   TAB_FULL - No room for the spawned thread
+ * 		   SYS_ERR - Queue is full
+ */
+int inject(int type, tid_t tid, thread_main func, int arg);
+
+/**
+ * Returns non-zero if the injection queue holds a request.
+ */
+int inject_pending();
+
+/**
+ * Handles the requests in the injection queue (a batch of
+ * up to UT_INJECT_QUEUE_SIZE), after recycling the finished
+ * injected threads' slots. Runs in the scheduler only.
+ */
+void drain_injected();
+
+/**
+ * Starts a thread requested by ut_inject_spawn(), in a new slot
+ * or a recycled one, without malloc() - we're in a signal handler.
+ */
+void spawn_injected(unsigned int slot, thread_main main, int arg);
+
+/**
+ * Hands a parked thread its permit, waking it if it waits.
+ */
+void wake_parked(tid_t tid);
+
+/**
+ * Returns the scheduler's clock, in microseconds (the
+ * virtual clock in a simulation). Quotas and CPU bursts
+ * are measured on it.
+ */
+unsigned long sched_now_us();
+
+/**
+ * Checks whether a group used up its budget, refilling it
+ * first if a new period began (lazily, in O(1)).
+ * @param group The group, or NO_GROUP
+ * @param now_us Current time
+ * @return 0 - The group's threads may run
+ * 		   Otherwise - When the budget is refilled
+ */
+unsigned long group_throttled_until(int group, unsigned long now_us);
+
+/**
+ * Finds the next ready thread of a thread's group,
+ * round-robin after it.
+ * @param tid The thread
+ * @param now_ms Current time, to wake sleepers
+ * @return Its TID, SYS_ERR if there's none
+ */
+tid_t next_in_group(tid_t tid, unsigned long now_ms);
+
+/**
+ * Charges a thread's group for the CPU time it used.
+ * @param tid The running thread
+ * @param usec CPU time used
+ * @return Non-zero if the group is now throttled
+ */
+int group_charge(tid_t tid, unsigned long usec);
+
+/**
+ * Reads the CPU's time-stamp counter.
+ * @return Cycles since reset
+ */
+static inline unsigned long long read_cycles()
+{
+	unsigned int lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+
+	return ((unsigned long long)hi << 32) | lo;
+}
+
+/**
+ * Accounts for the end of a thread's time slice: how much
+ * of the quantum it used, and whether it still waits for
+ * the CPU or has blocked.
+ * @param tid The thread leaving the CPU
+ * @param now_us Current time
+ */
+void account_slice_end(tid_t tid, unsigned long now_us);
+
+/**
+ * Accounts for a thread getting the CPU: how long it
+ * waited since it became ready.
+ * @param tid The thread getting the CPU
+ * @param now_us Current time
+ */
+void account_dispatch(tid_t tid, unsigned long now_us);
+
+/**
+ * Accounts for the cycles spent switching to the running
+ * thread. Runs right after the switch, in the new thread.
+ */
+void account_switch_cycles();
+
+/**
+ * Starts the quantum of the thread about to run. With
+ * adaptive slices, its length follows the thread's average
+ * CPU burst: twice the burst, within the configured bounds.
+ * @param tid The thread about to run
+ */
+void arm_quantum(tid_t tid);
+
+/**
+ * Returns the next number of the simulation's
+ * pseudo-random sequence (xorshift).
+ */
+unsigned long sim_random();
+
+/**
+ * Entry point of every thread. Runs the thread's function
+ * and retires the thread once the function returns.
+ * @param slot Slot of the thread in the table
+ */
+void thread_entry(int slot);
+
+/**
+ * Stops the scheduler & profiler timers, after
+ * all the threads have finished.
+ */
+void stop_timers();
+
+/**
+ * Prints the stack high-water mark of every thread,
+ * registered with atexit() when the measurement is on.
+ */
+void report_stack_hwm();
+
 /**
  * Counts the number of msec the current thread is running.
  * @param signal
  */
 void profiler(int signal);
 
+/**
+ * Copies the threads' counters into the statistics
+ * segment (if enabled). Runs in signal context only, or
+ * in a simulation (where nothing can interrupt it).
+ */
+void publish_stats();
+
 /**
  * Initializes the scheduler mechanism.
  * @return 0 - Success
@@ -95,9 +462,30 @@ void set_num_threads_in_valid_range(int tab_size)
 
 int ut_init(int tab_size)
 {
+	unsigned long i;
+
 	/* Init counters */
 	s_num_spawned_threads = 0;
+	s_num_reserved_threads = 0;
+	s_num_finished_threads = 0;
 	s_threads_size = 0;
+	memset(s_threads_info, 0, sizeof(s_threads_info));
+
+	/* Every cell of the injection queue is free */
+	for (i = 0; i < UT_INJECT_QUEUE_SIZE; ++i)
+	{
+		s_inject_queue[i].seq = i;
+	}
+	s_inject_head = 0;
+	s_inject_tail = 0;
+
+	/* No slot was freed yet */
+	for (i = 0; i < MAX_TAB_SIZE; ++i)
+	{
+		s_free_slots[i].seq = i;
+	}
+	s_free_head = 0;
+	s_free_tail = 0;
 
 	/* Set the table size */
 	set_num_threads_in_valid_range(tab_size);
@@ -116,9 +504,9 @@ int ut_init(int tab_size)
 
 tid_t ut_spawn_thread(thread_main main, int arg)
 {
-	unsigned int current_slot = s_num_spawned_threads + 1;
-	ut_slot pCurrThreadSlot = &s_threads[current_slot];
-	ucontext_t* pCurrThreadContext = &pCurrThreadSlot->uc;
+	int current_slot;
+	unsigned long stack_size = s_stack_size;
+	void *pStack;
 
 	/* Assert that the lib was initiated already */
 	if (s_threads == NULL)
@@ -126,17 +514,66 @@ tid_t ut_spawn_thread(thread_main main, int arg)
 		return SYS_ERR;
 	}
 
-	/* Make sure there is room in the table */
-	if (current_slot >= s_threads_size)
+	/* Make sure there is room in the table.
+	 * Injected threads may take slots concurrently.
+	 */
+	current_slot = reserve_slot();
+	if (current_slot == TAB_FULL)
 	{
 		return TAB_FULL;
 	}
-	/* Count the new thread as created */
-	else
+
+	/* Allocate stack space for the thread */
+	pStack = malloc(stack_size);
+
+	/* Make sure stack allocated correctly, and the thread
+	 * set up. A failed slot is never run.
+	 */
+	if (pStack == NULL ||
+		setup_slot(current_slot, main, arg, pStack, stack_size) != 0)
 	{
-		s_num_spawned_threads++;
+		retire_slot(current_slot);
+		publish_slots();
+		return SYS_ERR;
 	}
 
+	/* Count the new thread as created */
+	s_threads_info[current_slot].published = 1;
+	publish_slots();
+
+	/* The thread at slot 0 is the main thread,
+	 * we don't count it as a thread with TID,
+	 * so slot 1 is TID 0 de-facto.
+	 */
+	return current_slot - 1;
+}
+
+int reserve_slot()
+{
+	unsigned int reserved;
+
+	do
+	{
+		reserved = s_num_reserved_threads;
+
+		/* Slot 0 is the main thread's */
+		if (reserved + 1 >= s_threads_size)
+		{
+			return TAB_FULL;
+		}
+	} while (!__sync_bool_compare_and_swap(&s_num_reserved_threads,
+										   reserved, reserved + 1));
+
+	return reserved + 1;
+}
+
+int setup_slot(unsigned int slot, thread_main main, int arg,
+			   void *pStack, unsigned long stack_size)
+{
+	ut_slot pCurrThreadSlot = &s_threads[slot];
+	ucontext_t* pCurrThreadContext = &pCurrThreadSlot->uc;
+	ut_thread_info_t *pInfo = &s_threads_info[slot];
+
 	/* Get the context of the current thread */
 	if (getcontext(pCurrThreadContext) == SYS_ERR)
 	{
@@ -147,15 +584,17 @@ tid_t ut_spawn_thread(thread_main main, int arg)
 	 * link it to original thread.
 	 */
 	pCurrThreadContext->uc_link = &s_threads[0].uc;
+	pCurrThreadContext->uc_stack.ss_sp = pStack;
+	pCurrThreadContext->uc_stack.ss_size = stack_size;
+	pCurrThreadSlot->stack = pStack;
+	pInfo->stack_size = stack_size;
+	pInfo->sig_frames_size = 0;
 
-	/* Allocate stack space for the thread */
-	pCurrThreadContext->uc_stack.ss_sp = malloc(STACKSIZE);
-	pCurrThreadContext->uc_stack.ss_size = STACKSIZE;
-
-	/* Make sure stack allocated correctly */
-	if (pCurrThreadContext->uc_stack.ss_sp == NULL)
+	/* Paint the stack, so we can later tell how deep it was used */
+	pInfo->painted = s_stack_hwm_enabled;
+	if (pInfo->painted)
 	{
-		return SYS_ERR;
+		memset(pCurrThreadSlot->stack, STACK_CANARY, stack_size);
 	}
 
 	/* Set the thread's function and arg */
@@ -165,120 +604,1537 @@ tid_t ut_spawn_thread(thread_main main, int arg)
 	/* Init the running time */
 	pCurrThreadSlot->vtime = 0;
 
-	/* The thread at slot 0 is the main thread,
-	 * we don't count it as a thread with TID,
-	 * so slot 1 is TID 0 de-facto.
-	 */
-	return current_slot - 1;
+	/* Ready to run */
+	pInfo->state = THREAD_READY;
+	pInfo->switches = 0;
+	pInfo->slice_us = QUANTOM_USEC;
+	pInfo->burst_us = 0;
+	pInfo->group = NO_GROUP;
+	pInfo->park_permit = 0;
+	pInfo->wait_obj = NULL;
+	memset(&pInfo->sched_stats, 0, sizeof(pInfo->sched_stats));
+
+	return 0;
 }
 
-int ut_start(void)
+void retire_slot(unsigned int slot)
 {
-	/* Init scheduler mechanism */
-	if (init_scheduler() != 0) return SYS_ERR;
-
-	/* Set the 'profiler' signal */
-	if (init_profiler() != 0) return SYS_ERR;
-
-	/* Start all the threads */
-	if (prepare_all_threads() != 0) return SYS_ERR;
-
-	/* Init to run the first thread */
-	s_current_thread_id = 0;
-
-	/* Start running the system */
-	errno = 0;
-	alarm(QUANTOM_SEC);
+	s_threads_info[slot].state = THREAD_FINISHED;
+	s_threads_info[slot].painted = 0; /* Never ran, nothing to measure */
+	s_num_finished_threads++;
+	s_threads_info[slot].published = 1;
+}
 
-	/* If swapcontext returns, its an error.
-	 * In that case 'errno' will be set on any failure.
+void publish_slots()
+{
+	/* In slot order, the round-robin goes over
+	 * the first s_num_spawned_threads slots.
 	 */
-	swapcontext(&s_threads[0].uc,
-				&s_threads[1].uc);
+	while (s_num_spawned_threads < s_num_reserved_threads &&
+		   s_threads_info[s_num_spawned_threads + 1].published)
+	{
+		s_num_spawned_threads++;
+	}
+}
 
-	/* Make sure system started */
-	if (errno != 0)
+tid_t ut_inject_spawn(thread_main main, int arg)
+{
+	/* Assert that the lib was initiated already */
+	if (s_threads == NULL)
 	{
 		return SYS_ERR;
 	}
 
-	return 0;
+	return inject(INJECT_SPAWN, SYS_ERR, main, arg);
 }
 
-unsigned long ut_get_vtime(tid_t tid)
+int ut_inject_wake(tid_t tid)
 {
-	/* Don't access illegal memory */
 	if (s_threads == NULL ||
-		tid > s_threads_size)
+		tid < 0 || tid >= s_num_reserved_threads)
 	{
-		return 0;
+		return SYS_ERR;
 	}
 
-	return s_threads[tid].vtime;
+	return inject(INJECT_WAKE, tid, NULL, 0);
 }
 
-void scheduler(int signal)
+void ut_park(void)
 {
-	tid_t previous_thread_id = s_current_thread_id;
+	ut_thread_info_t *pInfo;
 
-	// Make sure thread table allocated
-	if (s_threads == NULL)
+	/* Only threads can wait */
+	if (!s_started) return;
+
+	pInfo = &s_threads_info[s_current_thread_id + 1];
+
+	/* The permit is only handed in the scheduler,
+	 * which can't run between the check and the wait.
+	 */
+	ut_preempt_disable();
+	while (__sync_lock_test_and_set(&pInfo->park_permit, 0) == 0)
 	{
-		errno = 1;
-		perror("scheduler cannot access thread table as it doesn't exist.\n");
-		exit(1);
+		ut_wait((void *)&pInfo->park_permit);
 	}
+	ut_preempt_enable();
+}
 
-	/* Set the next scheduling to occur */
-	errno = 0;
-	alarm(QUANTOM_SEC);
+int inject(int type, tid_t tid, thread_main func, int arg)
+{
+	unsigned long pos = s_inject_tail;
+	inject_cell_t *pCell;
+	int result = 0;
 
-	/* Handle list's circularity, next thread */
-	s_current_thread_id++;
-	if (s_current_thread_id == s_num_spawned_threads)
+	while (1)
 	{
-		s_current_thread_id = 0;
-	}
+		long diff;
 
-	/* Swap to the current one */
-	swapcontext(&s_threads[previous_thread_id + 1].uc,
-			    &s_threads[s_current_thread_id + 1].uc);
+		pCell = &s_inject_queue[pos & INJECT_MASK];
+		diff = (long)pCell->seq - (long)pos;
 
-	/* Critical error.. */
-	if (errno != 0)
+		/* Cell is free, try claiming it */
+		if (diff == 0)
+		{
+			if (__sync_bool_compare_and_swap(&s_inject_tail, pos, pos + 1))
+			{
+				break;
+			}
+			pos = s_inject_tail;
+		}
+		/* Cell wasn't drained yet, the queue is full */
+		else if (diff < 0)
+		{
+			return SYS_ERR;
+		}
+		/* Someone else claimed it, try again */
+		else
+		{
+			pos = s_inject_tail;
+		}
+	}
+
+	/* The cell is ours, a slot taken after it can't be left
+	 * unpublished. No slot - the cell is published empty.
+	 */
+	if (type == INJECT_SPAWN)
 	{
-		perror("scheduler\n");
-		exit(1);
+		result = take_free_slot();
+		if (result == TAB_FULL)
+		{
+			result = reserve_slot();
+		}
+
+		if (result == TAB_FULL)
+		{
+			type = INJECT_NOP;
+		}
+		else
+		{
+			tid = result - 1;
+			result = tid;
+		}
 	}
+
+	pCell->type = type;
+	pCell->tid = tid;
+	pCell->func = func;
+	pCell->arg = arg;
+
+	/* Publish the cell to the scheduler */
+	__sync_synchronize();
+	pCell->seq = pos + 1;
+
+	return result;
 }
 
-unsigned int init_scheduler()
+int take_free_slot()
 {
-	struct sigaction sa;
+	unsigned long pos = s_free_head;
 
-	/* Prepare the scheduler's handler struct */
-	sa.sa_flags = SA_RESTART;
-	if (sigfillset(&sa.sa_mask) == SYS_ERR) return SYS_ERR;
-	sa.sa_handler = scheduler;
+	while (1)
+	{
+		free_slot_cell_t *pCell = &s_free_slots[pos & FREE_SLOTS_MASK];
+		long diff = (long)pCell->seq - (long)(pos + 1);
 
-	/* Set the 'scheduler' signal */
-	if (sigaction(SIGALRM, &sa, NULL) < 0) return SYS_ERR;
+		/* Cell holds a slot, try claiming it */
+		if (diff == 0)
+		{
+			if (__sync_bool_compare_and_swap(&s_free_head, pos, pos + 1))
+			{
+				unsigned int slot = pCell->slot;
 
-	return 0;
+				/* Hand the cell back to the scheduler, one lap later */
+				__sync_synchronize();
+				pCell->seq = pos + MAX_TAB_SIZE;
+				return slot;
+			}
+			pos = s_free_head;
+		}
+		/* Nothing was put there yet, the list is empty */
+		else if (diff < 0)
+		{
+			return TAB_FULL;
+		}
+		/* Someone else claimed it, try again */
+		else
+		{
+			pos = s_free_head;
+		}
+	}
 }
 
-void profiler(int signal)
+void recycle_slots()
 {
-	// Make sure thread table allocated
-	if (s_threads == NULL)
+	unsigned int slot;
+
+	for (slot = 1; slot <= s_num_spawned_threads; ++slot)
 	{
-		errno = 1;
-		perror("profiler cannot access thread table as it doesn't exist.\n");
+		ut_thread_info_t *pInfo = &s_threads_info[slot];
+		free_slot_cell_t *pCell = &s_free_slots[s_free_tail & FREE_SLOTS_MASK];
+
+		/* The current thread's stack may still be in use */
+		if (!pInfo->mapped ||
+			pInfo->state != THREAD_FINISHED ||
+			slot == s_current_thread_id + 1)
+		{
+			continue;
+		}
+
+		/* Holds every slot, a slot is in it once */
+		if (pCell->seq != s_free_tail) break;
+
+		munmap(s_threads[slot].stack, pInfo->stack_size);
+		s_threads[slot].stack = NULL;
+		pInfo->mapped = 0;
+		pInfo->painted = 0;
+
+		/* Publish the slot to the producers */
+		pCell->slot = slot;
+		__sync_synchronize();
+		pCell->seq = s_free_tail + 1;
+		s_free_tail++;
+	}
+}
+
+int inject_pending()
+{
+	return s_inject_queue[s_inject_head & INJECT_MASK].seq == s_inject_head + 1;
+}
+
+void drain_injected()
+{
+	int saved_errno = errno;
+	unsigned int handled;
+
+	/* Finished threads make room for the injected ones */
+	recycle_slots();
+
+	/* A batch at most, producers can't keep us here forever */
+	for (handled = 0; handled < UT_INJECT_QUEUE_SIZE && inject_pending(); ++handled)
+	{
+		inject_cell_t *pCell = &s_inject_queue[s_inject_head & INJECT_MASK];
+
+		__sync_synchronize();
+
+		if (pCell->type == INJECT_SPAWN)
+		{
+			spawn_injected(pCell->tid + 1, pCell->func, pCell->arg);
+		}
+		else if (pCell->type == INJECT_WAKE)
+		{
+			wake_parked(pCell->tid);
+		}
+
+		/* Hand the cell back to the producers, one lap later.
+		 * Single consumer, no need to claim the cell.
+		 */
+		__sync_synchronize();
+		pCell->seq = s_inject_head + UT_INJECT_QUEUE_SIZE;
+		s_inject_head++;
+	}
+
+	publish_slots();
+
+	/* A failure here isn't the switch's failure */
+	errno = saved_errno;
+}
+
+void spawn_injected(unsigned int slot, thread_main main, int arg)
+{
+	ucontext_t *pContext = &s_threads[slot].uc;
+	ut_thread_info_t *pInfo = &s_threads_info[slot];
+	unsigned long stack_size = s_stack_size;
+	void *pStack;
+
+	/* A recycled slot was counted as a finished thread,
+	 * it's set up again like a new one.
+	 */
+	if (pInfo->published)
+	{
+		pInfo->published = 0;
+		s_num_finished_threads--;
+	}
+
+	/* mmap() is a plain system call, unlike malloc() */
+	pStack = mmap(NULL, stack_size,
+				  PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS,
+				  -1, 0);
+
+	if (pStack == MAP_FAILED)
+	{
+		retire_slot(slot);
+		return;
+	}
+
+	if (setup_slot(slot, main, arg, pStack, stack_size) != 0)
+	{
+		munmap(pStack, stack_size);
+		retire_slot(slot);
+		return;
+	}
+	pInfo->mapped = 1;
+
+	/* The context was taken in the scheduler, with all the
+	 * signals blocked - run with the mask ut_start() ran with.
+	 */
+	pContext->uc_sigmask = s_thread_sigmask;
+
+	errno = 0;
+	makecontext(pContext, (void(*)(void))thread_entry, 1, slot);
+	if (errno != 0)
+	{
+		/* Finished, recycled on the next drain */
+		retire_slot(slot);
+		return;
+	}
+
+	pInfo->ready_at_us = ut_stats_now_us();
+	pInfo->published = 1;
+}
+
+void wake_parked(tid_t tid)
+{
+	ut_thread_info_t *pInfo = &s_threads_info[tid + 1];
+
+	/* Still being spawned, or gone */
+	if (!pInfo->published || pInfo->state == THREAD_FINISHED)
+	{
+		return;
+	}
+
+	pInfo->park_permit = 1;
+
+	if (pInfo->state == THREAD_BLOCKED &&
+		pInfo->wait_obj == (void *)&pInfo->park_permit)
+	{
+		ut_wake_one((void *)&pInfo->park_permit, 0);
+	}
+}
+
+int ut_start(void)
+{
+	unsigned long now_us;
+	unsigned int i;
+
+	/* Injected threads get the mask the others were spawned with */
+	if (sigprocmask(SIG_SETMASK, NULL, &s_thread_sigmask) != 0) return SYS_ERR;
+
+	/* Init scheduler mechanism */
+	if (init_scheduler() != 0) return SYS_ERR;
+
+	/* Set the 'profiler' signal.
+	 * A simulation accounts for virtual time instead.
+	 */
+	if (!s_sim_enabled && init_profiler() != 0) return SYS_ERR;
+
+	/* Threads injected so far join the others */
+	drain_injected();
+
+	/* Start all the threads */
+	if (prepare_all_threads() != 0) return SYS_ERR;
+
+	/* Init to run the first thread */
+	s_current_thread_id = 0;
+	s_threads_info[1].switches++;
+	s_started = 1;
+
+	/* Everyone is ready from now on, the first thread runs */
+	now_us = ut_stats_now_us();
+	for (i = 1; i <= s_num_spawned_threads; ++i)
+	{
+		s_threads_info[i].ready_at_us = now_us;
+	}
+	account_dispatch(0, now_us);
+	s_switch_start_cycles = read_cycles();
+
+	/* Start running the system */
+	errno = 0;
+	arm_quantum(0);
+
+	/* If swapcontext returns, its an error.
+	 * In that case 'errno' will be set on any failure.
+	 */
+	swapcontext(&s_threads[0].uc,
+				&s_threads[1].uc);
+
+	/* Make sure system started */
+	if (errno != 0)
+	{
+		return SYS_ERR;
+	}
+
+	return 0;
+}
+
+unsigned long ut_get_vtime(tid_t tid)
+{
+	/* Don't access illegal memory */
+	if (s_threads == NULL ||
+		tid > s_threads_size)
+	{
+		return 0;
+	}
+
+	return s_threads[tid].vtime;
+}
+
+int ut_set_stack_size(unsigned long size)
+{
+	if (size < UT_MIN_STACKSIZE)
+	{
+		return SYS_ERR;
+	}
+
+	s_stack_size = size;
+
+	return 0;
+}
+
+void ut_enable_stack_hwm(void)
+{
+	/* Report only once */
+	if (!s_stack_hwm_enabled)
+	{
+		atexit(report_stack_hwm);
+	}
+
+	s_stack_hwm_enabled = 1;
+}
+
+long ut_get_stack_hwm(tid_t tid)
+{
+	unsigned char *pStack;
+	long stack_size;
+	long untouched = 0;
+
+	/* Don't access illegal memory */
+	if (s_threads == NULL ||
+		tid < 0 ||
+		tid >= s_num_spawned_threads)
+	{
+		return SYS_ERR;
+	}
+
+	/* Spawned before the measurement was on */
+	if (!s_threads_info[tid + 1].painted)
+	{
+		return SYS_ERR;
+	}
+
+	pStack = s_threads[tid + 1].stack;
+	stack_size = s_threads_info[tid + 1].stack_size;
+
+	/* Stack grows down, the canary survives at the bottom */
+	while (untouched < stack_size && pStack[untouched] == STACK_CANARY)
+	{
+		untouched++;
+	}
+
+	return stack_size - untouched;
+}
+
+void report_stack_hwm()
+{
+	tid_t tid;
+
+	for (tid = 0; tid < s_num_spawned_threads; ++tid)
+	{
+		long used = ut_get_stack_hwm(tid);
+		long stack_size = s_threads_info[tid + 1].stack_size;
+
+		char line[128];
+		int length;
+
+		/* Nothing to tell about an unpainted stack */
+		if (used < 0) continue;
+
+		/* Runs on whichever thread exits, stdio's unbuffered
+		 * stderr would take more stack than the thread has.
+		 */
+		length = snprintf(line, sizeof(line),
+						  "Thread (%d) used %ld of %ld stack bytes%s\n",
+						  tid, used, stack_size,
+						  used == stack_size ? " (overflowed?)" : "");
+		if (write(STDERR_FILENO, line, length) < 0) return;
+	}
+}
+
+unsigned int ut_num_live_threads(void)
+{
+	return s_num_spawned_threads - s_num_finished_threads;
+}
+
+tid_t ut_self(void)
+{
+	/* Main context isn't a thread */
+	if (!s_started)
+	{
+		return SYS_ERR;
+	}
+
+	return s_current_thread_id;
+}
+
+unsigned long ut_now_ms(void)
+{
+	struct timespec ts;
+
+	/* Simulated time only moves forward by the threads' actions */
+	if (s_sim_enabled)
+	{
+		return s_sim_now_ms;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+void ut_sleep(unsigned long msec)
+{
+	ut_thread_info_t *pInfo;
+
+	/* Not a thread, just wait */
+	if (!s_started)
+	{
+		if (s_sim_enabled)
+		{
+			s_sim_now_ms += msec;
+		}
+		else
+		{
+			usleep(msec * 1000);
+		}
+		return;
+	}
+
+	pInfo = &s_threads_info[s_current_thread_id + 1];
+
+	/* The scheduler won't pick us until then */
+	pInfo->wake_ms = ut_now_ms() + msec;
+	pInfo->state = THREAD_SLEEPING;
+
+	ut_yield();
+}
+
+int ut_sim_enable(unsigned long seed)
+{
+	/* Can't switch clocks while running */
+	if (s_started)
+	{
+		return SYS_ERR;
+	}
+
+	s_sim_enabled = 1;
+	s_sim_now_ms = 0;
+
+	/* xorshift never leaves 0 */
+	s_sim_random = (seed != 0) ? seed : 1;
+
+	return 0;
+}
+
+void ut_sim_point(void)
+{
+	int throttled;
+
+	/* Only meaningful in a running simulation */
+	if (!s_sim_enabled || !s_started) return;
+
+	/* The point stands for a slice of CPU work */
+	s_sim_now_ms += SIM_POINT_MSEC;
+	s_threads[s_current_thread_id].vtime += SIM_POINT_MSEC;
+	throttled = group_charge(s_current_thread_id, SIM_POINT_MSEC * 1000);
+
+	if (s_sim_now_ms % PROFILER_INTERVAL_MSEC == 0)
+	{
+		publish_stats();
+	}
+
+	/* Quantum is over, or the group's budget */
+	if (--s_sim_budget == 0 || throttled)
+	{
+		ut_yield();
+	}
+}
+
+unsigned long sim_random()
+{
+	s_sim_random ^= s_sim_random << 13;
+	s_sim_random ^= s_sim_random >> 7;
+	s_sim_random ^= s_sim_random << 17;
+
+	return s_sim_random;
+}
+
+void ut_yield(void)
+{
+	/* The scheduler runs on SIGALRM, trigger it now */
+	kill(getpid(), SIGALRM);
+}
+
+void ut_preempt_disable(void)
+{
+	s_preempt_disabled++;
+}
+
+void ut_preempt_enable(void)
+{
+	/* Still nested */
+	if (--s_preempt_disabled > 0) return;
+
+	/* The quantum ended while we were in the section */
+	if (s_resched_pending)
+	{
+		s_resched_pending = 0;
+		ut_yield();
+	}
+}
+
+int wait_on(void *obj, int state, int keep_ticket)
+{
+	ut_thread_info_t *pInfo = &s_threads_info[s_current_thread_id + 1];
+	int preempt_depth;
+	int granted;
+
+	/* Take a place in line, the state goes last
+	 * so waking up never sees half a registration.
+	 */
+	pInfo->wait_obj = obj;
+	if (!keep_ticket)
+	{
+		pInfo->wait_ticket = s_next_wait_ticket++;
+	}
+	pInfo->granted = 0;
+	pInfo->state = state;
+
+	/* Registered, others may run now */
+	preempt_depth = s_preempt_disabled;
+	s_preempt_disabled = 0;
+
+	/* The scheduler won't pick us until we're woken (or,
+	 * sleeping, until the time is up)
+	 */
+	while (pInfo->state == state)
+	{
+		ut_yield();
+	}
+
+	s_preempt_disabled = preempt_depth;
+
+	pInfo->wait_obj = NULL;
+	granted = pInfo->granted;
+	pInfo->granted = 0;
+
+	return granted;
+}
+
+int ut_wait(void *obj)
+{
+	/* Only threads can wait */
+	if (!s_started) return 0;
+
+	return wait_on(obj, THREAD_BLOCKED, 0);
+}
+
+int ut_wait_again(void *obj)
+{
+	/* Only threads can wait */
+	if (!s_started) return 0;
+
+	return wait_on(obj, THREAD_BLOCKED, 1);
+}
+
+int ut_wait_timeout(void *obj, unsigned long msec)
+{
+	/* Only threads can wait */
+	if (!s_started) return 0;
+
+	/* Sleeps on the object, a wake up ends the sleep early */
+	s_threads_info[s_current_thread_id + 1].wake_ms = ut_now_ms() + msec;
+
+	return wait_on(obj, THREAD_SLEEPING, 0);
+}
+
+tid_t ut_wake_one(void *obj, int grant)
+{
+	ut_thread_info_t *pFirst = NULL;
+	tid_t first_tid = SYS_ERR;
+	tid_t tid;
+
+	/* Find the waiter that's been there the longest */
+	for (tid = 0; tid < s_num_spawned_threads; ++tid)
+	{
+		ut_thread_info_t *pInfo = &s_threads_info[tid + 1];
+
+		if ((pInfo->state == THREAD_BLOCKED ||
+			 pInfo->state == THREAD_SLEEPING) &&
+			pInfo->wait_obj == obj &&
+			(pFirst == NULL || pInfo->wait_ticket < pFirst->wait_ticket))
+		{
+			pFirst = pInfo;
+			first_tid = tid;
+		}
+	}
+
+	/* Nobody waits */
+	if (pFirst == NULL)
+	{
+		return SYS_ERR;
+	}
+
+	pFirst->wait_obj = NULL;
+	pFirst->granted = grant;
+	pFirst->ready_at_us = ut_stats_now_us();
+	pFirst->state = THREAD_READY;
+
+	return first_tid;
+}
+
+void ut_switch_to(tid_t tid)
+{
+	/* Don't access illegal memory */
+	if (!s_started || tid < 0 || tid >= s_num_spawned_threads)
+	{
+		return;
+	}
+
+	/* The scheduler picks it instead of the next in line */
+	s_handoff_target = tid;
+	ut_yield();
+}
+
+int ut_group_create(void)
+{
+	ut_group_t *pGroup;
+
+	/* No room for another group */
+	if (s_num_groups >= UT_MAX_GROUPS)
+	{
+		return TAB_FULL;
+	}
+
+	/* No quota until set */
+	pGroup = &s_groups[s_num_groups];
+	pGroup->period_us = 0;
+	pGroup->budget_us = 0;
+	pGroup->used_us = 0;
+	pGroup->period_start_us = 0;
+	pGroup->last_throttled = SYS_ERR;
+
+	return s_num_groups++;
+}
+
+int ut_group_add(int group, tid_t tid)
+{
+	/* Don't access illegal memory */
+	if (group < 0 || group >= s_num_groups ||
+		s_threads == NULL ||
+		tid < 0 || tid >= s_num_spawned_threads)
+	{
+		return SYS_ERR;
+	}
+
+	s_threads_info[tid + 1].group = group;
+
+	return 0;
+}
+
+int ut_group_set_quota(int group, unsigned long period_us,
+					   unsigned long budget_us)
+{
+	ut_group_t *pGroup;
+
+	if (group < 0 || group >= s_num_groups)
+	{
+		return SYS_ERR;
+	}
+
+	/* A quota must allow some CPU time */
+	if (period_us != 0 && budget_us == 0)
+	{
+		return SYS_ERR;
+	}
+
+	/* The profiler may charge the group meanwhile,
+	 * keep it unlimited until the new quota is set.
+	 */
+	pGroup = &s_groups[group];
+	pGroup->period_us = 0;
+	pGroup->budget_us = budget_us;
+	pGroup->used_us = 0;
+	pGroup->period_start_us = sched_now_us();
+	pGroup->last_throttled = SYS_ERR;
+	pGroup->period_us = period_us;
+
+	return 0;
+}
+
+unsigned long sched_now_us()
+{
+	if (s_sim_enabled)
+	{
+		return s_sim_now_ms * 1000;
+	}
+
+	return ut_stats_now_us();
+}
+
+unsigned long group_throttled_until(int group, unsigned long now_us)
+{
+	ut_group_t *pGroup;
+	unsigned long periods;
+	unsigned long refill_us;
+
+	/* Not limited */
+	if (group == NO_GROUP || s_groups[group].period_us == 0)
+	{
+		return 0;
+	}
+
+	pGroup = &s_groups[group];
+
+	/* Catch up on all the periods passed at once.
+	 * An overrun of the last tick is paid from the new budget.
+	 */
+	if (now_us - pGroup->period_start_us >= pGroup->period_us)
+	{
+		periods = (now_us - pGroup->period_start_us) / pGroup->period_us;
+		refill_us = periods * pGroup->budget_us;
+
+		pGroup->period_start_us += periods * pGroup->period_us;
+		pGroup->used_us = (pGroup->used_us > refill_us) ?
+						  pGroup->used_us - refill_us : 0;
+	}
+
+	if (pGroup->used_us < pGroup->budget_us)
+	{
+		return 0;
+	}
+
+	return pGroup->period_start_us + pGroup->period_us;
+}
+
+tid_t next_in_group(tid_t tid, unsigned long now_ms)
+{
+	int group = s_threads_info[tid + 1].group;
+	unsigned int i;
+
+	for (i = 1; i < s_num_spawned_threads; ++i)
+	{
+		tid_t mate = (tid + i) % s_num_spawned_threads;
+		ut_thread_info_t *pInfo = &s_threads_info[mate + 1];
+
+		if (pInfo->group != group) continue;
+
+		/* Time to wake up */
+		if (pInfo->state == THREAD_SLEEPING && pInfo->wake_ms <= now_ms)
+		{
+			pInfo->ready_at_us = ut_stats_now_us();
+			pInfo->state = THREAD_READY;
+		}
+
+		if (pInfo->state == THREAD_READY)
+		{
+			return mate;
+		}
+	}
+
+	return SYS_ERR;
+}
+
+int group_charge(tid_t tid, unsigned long usec)
+{
+	int group = s_threads_info[tid + 1].group;
+	unsigned long now_us;
+
+	if (group == NO_GROUP || s_groups[group].period_us == 0)
+	{
+		return 0;
+	}
+
+	/* The tick may belong to a new period already */
+	now_us = sched_now_us();
+	group_throttled_until(group, now_us);
+
+	s_groups[group].used_us += usec;
+
+	if (group_throttled_until(group, now_us) == 0)
+	{
+		return 0;
+	}
+
+	/* Give its group mates a turn after the refill */
+	s_groups[group].last_throttled = tid;
+
+	return 1;
+}
+
+void ut_set_handoff(int enable)
+{
+	s_handoff_enabled = enable;
+}
+
+int ut_handoff_enabled(void)
+{
+	return s_handoff_enabled;
+}
+
+void thread_entry(int slot)
+{
+	ut_slot pThread = &s_threads[slot];
+
+	/* First time on the CPU */
+	account_switch_cycles();
+
+	/* Run the thread's code */
+	pThread->func(pThread->arg);
+
+	/* Thread is done, everything it allocated goes away with it */
+	ut_alloc_reset(slot - 1);
+
+	/* Never schedule it again */
+	s_threads_info[slot].state = THREAD_FINISHED;
+	s_num_finished_threads++;
+
+	/* Move to the next thread, we won't be back */
+	ut_yield();
+}
+
+void stop_timers()
+{
+	struct itimerval itv = { { 0, 0 }, { 0, 0 } };
+
+	alarm(0);
+	s_tick_us = 0;
+	setitimer(ITIMER_VIRTUAL, &itv, NULL);
+}
+
+void scheduler(int signal)
+{
+	tid_t previous_thread_id = s_current_thread_id;
+	unsigned long now_us;
+
+	// Make sure thread table allocated
+	if (s_threads == NULL)
+	{
+		errno = 1;
+		perror("scheduler cannot access thread table as it doesn't exist.\n");
+		exit(1);
+	}
+
+	/* In a critical section, switch as soon as it ends */
+	if (s_preempt_disabled)
+	{
+		s_resched_pending = 1;
+		return;
+	}
+
+	errno = 0;
+	s_resched_pending = 0;
+
+	/* The outgoing thread's slice is over */
+	s_switch_start_cycles = read_cycles();
+	now_us = ut_stats_now_us();
+	account_slice_end(previous_thread_id, now_us);
+
+	/* Direct handoff, the target gets the rest of the quantum */
+	if (s_handoff_target >= 0 &&
+		s_threads_info[s_handoff_target + 1].state == THREAD_READY &&
+		group_throttled_until(s_threads_info[s_handoff_target + 1].group,
+							  sched_now_us()) == 0)
+	{
+		s_current_thread_id = s_handoff_target;
+		s_threads_info[s_current_thread_id + 1].slice_us =
+			s_threads_info[previous_thread_id + 1].slice_us;
+	}
+	else
+	{
+		s_current_thread_id = pick_next_thread();
+
+		/* Set the next scheduling to occur */
+		arm_quantum(s_current_thread_id);
+	}
+	s_handoff_target = SYS_ERR;
+
+	if (s_current_thread_id != previous_thread_id)
+	{
+		s_threads_info[s_current_thread_id + 1].switches++;
+	}
+	account_dispatch(s_current_thread_id, now_us);
+
+	/* Swap to the current one. We're on the alternate stack,
+	 * which the switching context hands over to it.
+	 */
+	if (s_current_thread_id != previous_thread_id)
+	{
+		char here;
+
+		s_switch_from = previous_thread_id;
+		s_switch_to = s_current_thread_id;
+
+		/* Not run as a handler (shouldn't happen), switch directly */
+		if ((uintptr_t)&here - (uintptr_t)s_sig_stack >= SCHED_STACK_SIZE)
+		{
+			swapcontext(&s_threads[previous_thread_id + 1].uc,
+						&s_threads[s_current_thread_id + 1].uc);
+		}
+		else
+		{
+			swapcontext(&s_threads[previous_thread_id + 1].uc,
+						&s_switch_context);
+		}
+	}
+
+	/* Back in the thread that was picked */
+	account_switch_cycles();
+
+	/* Critical error.. */
+	if (errno != 0)
+	{
+		perror("scheduler\n");
+		exit(1);
+	}
+}
+
+tid_t pick_next_thread()
+{
+	while (1)
+	{
+		unsigned long now = ut_now_ms();
+		unsigned long now_us = sched_now_us();
+		unsigned long earliest_wake = 0;
+		int any_waiting = 0;
+		int any_blocked = 0;
+		unsigned int i;
+
+		/* New threads & wake ups from outside */
+		drain_injected();
+
+		/* All threads are done, go back to ut_start(). Unless
+		 * a request is still being queued, it may spawn one.
+		 */
+		if (s_num_finished_threads == s_num_spawned_threads &&
+			s_inject_head == s_inject_tail)
+		{
+			stop_timers();
+			s_started = 0;
+			errno = 0;
+			setcontext(&s_threads[0].uc);
+		}
+
+		/* Handle list's circularity, start after the current
+		 * thread and end with it.
+		 */
+		for (i = 1; i <= s_num_spawned_threads; ++i)
+		{
+			tid_t tid = (s_current_thread_id + i) % s_num_spawned_threads;
+			ut_thread_info_t *pInfo = &s_threads_info[tid + 1];
+
+			/* Time to wake up */
+			if (pInfo->state == THREAD_SLEEPING && pInfo->wake_ms <= now)
+			{
+				pInfo->ready_at_us = ut_stats_now_us();
+				pInfo->state = THREAD_READY;
+			}
+
+			if (pInfo->state == THREAD_READY)
+			{
+				unsigned long refill_us =
+					group_throttled_until(pInfo->group, now_us);
+				unsigned long refill_ms;
+
+				if (refill_us == 0)
+				{
+					/* Used the whole last budget, a ready mate of
+					 * its group goes first. Passed over only once.
+					 */
+					if (pInfo->group != NO_GROUP &&
+						s_groups[pInfo->group].last_throttled == tid)
+					{
+						tid_t mate = next_in_group(tid, now);
+
+						s_groups[pInfo->group].last_throttled = SYS_ERR;
+						if (mate >= 0) return mate;
+					}
+
+					return tid;
+				}
+
+				/* Throttled, its refill is like a wake up */
+				refill_ms = (refill_us + 999) / 1000;
+				if (!any_waiting || refill_ms < earliest_wake)
+				{
+					any_waiting = 1;
+					earliest_wake = refill_ms;
+				}
+			}
+
+			if (pInfo->state == THREAD_SLEEPING &&
+				(!any_waiting || pInfo->wake_ms < earliest_wake))
+			{
+				any_waiting = 1;
+				earliest_wake = pInfo->wake_ms;
+			}
+
+			if (pInfo->state == THREAD_BLOCKED)
+			{
+				any_blocked = 1;
+			}
+		}
+
+		/* Nobody to wait for: every thread left is blocked, and
+		 * only a wake up from outside could release one. Never
+		 * happens in a simulation, the threads are deadlocked.
+		 * A request still being queued is waited for.
+		 */
+		if (!any_waiting && s_inject_head == s_inject_tail &&
+			(s_sim_enabled || !any_blocked))
+		{
+			fprintf(stderr, "scheduler: deadlock, no thread can ever run\n");
+			exit(1);
+		}
+
+		/* Everyone sleeps, is throttled or blocked. A simulation
+		 * jumps right to the first wake up, otherwise (or if only
+		 * a request being queued is left) we really wait.
+		 */
+		if (s_sim_enabled && any_waiting)
+		{
+			s_sim_now_ms = earliest_wake;
+		}
+		else
+		{
+			sigset_t idle_mask, saved_mask;
+			int saved_errno = errno;
+
+			/* We may wait long for a wake up from outside, let in
+			 * the signals the threads take (e.g. SIGINT) meanwhile.
+			 */
+			idle_mask = s_thread_sigmask;
+			sigaddset(&idle_mask, SIGALRM);
+			sigaddset(&idle_mask, SIGVTALRM);
+			sigprocmask(SIG_SETMASK, &idle_mask, &saved_mask);
+
+			usleep(IDLE_SLEEP_MSEC * 1000);
+
+			sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+
+			/* A signal cutting the sleep short isn't the scheduler's error */
+			errno = saved_errno;
+		}
+	}
+}
+
+void ut_hist_record(ut_hist_t *hist, unsigned long value)
+{
+	unsigned int bucket = 0;
+
+	/* Bucket i holds the values of i significant bits */
+	while (bucket < UT_HIST_BUCKETS - 1 && (value >> bucket) != 0)
+	{
+		bucket++;
+	}
+
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum += value;
+	if (value > hist->max) hist->max = value;
+}
+
+void account_slice_end(tid_t tid, unsigned long now_us)
+{
+	ut_thread_info_t *pInfo = &s_threads_info[tid + 1];
+	unsigned long used_us = now_us - pInfo->slice_start_us;
+	unsigned long burst_us = sched_now_us() - pInfo->burst_start_us;
+	unsigned int decile = used_us * 10 / pInfo->slice_us;
+
+	/* Ran out of the quantum, the burst goes on - count it
+	 * longer, so a CPU-bound thread's slices keep growing.
+	 */
+	if (burst_us >= pInfo->slice_us)
+	{
+		burst_us = 2 * pInfo->slice_us;
+	}
+	pInfo->burst_us = pInfo->burst_us
+					  - (pInfo->burst_us >> BURST_EWMA_SHIFT)
+					  + (burst_us >> BURST_EWMA_SHIFT);
+
+	/* A handoff may stretch the slice past a quantum */
+	if (decile > UT_QUANTUM_DECILES - 1)
+	{
+		decile = UT_QUANTUM_DECILES - 1;
+	}
+
+	pInfo->sched_stats.quantum_use[decile]++;
+	s_sched_stats.quantum_use[decile]++;
+
+	/* Still ready - preempted, or yielded */
+	if (pInfo->state == THREAD_READY)
+	{
+		pInfo->ready_at_us = now_us;
+		pInfo->sched_stats.preempted++;
+		s_sched_stats.preempted++;
+	}
+	else
+	{
+		pInfo->sched_stats.blocked++;
+		s_sched_stats.blocked++;
+	}
+}
+
+void account_dispatch(tid_t tid, unsigned long now_us)
+{
+	ut_thread_info_t *pInfo = &s_threads_info[tid + 1];
+	unsigned long waited_us = now_us - pInfo->ready_at_us;
+
+	ut_hist_record(&pInfo->sched_stats.ready_latency_us, waited_us);
+	ut_hist_record(&s_sched_stats.ready_latency_us, waited_us);
+
+	pInfo->slice_start_us = now_us;
+	pInfo->burst_start_us = sched_now_us();
+}
+
+void arm_quantum(tid_t tid)
+{
+	ut_thread_info_t *pInfo = &s_threads_info[tid + 1];
+	unsigned long slice_us = QUANTOM_USEC;
+	unsigned long points;
+
+	if (s_min_slice_us != 0)
+	{
+		slice_us = 2 * pInfo->burst_us;
+
+		if (slice_us < s_min_slice_us) slice_us = s_min_slice_us;
+		if (slice_us > s_max_slice_us) slice_us = s_max_slice_us;
+	}
+
+	pInfo->slice_us = slice_us;
+
+	if (s_sim_enabled)
+	{
+		/* Random, but the same length on average */
+		points = slice_us / 1000 / SIM_POINT_MSEC;
+		if (points == 0) points = 1;
+
+		s_sim_budget = 1 + sim_random() % (2 * points);
+	}
+	else if (s_min_slice_us != 0)
+	{
+		/* A periodic tick of the shortest slice, counted down per
+		 * quantum - re-arming the timer on every switch is a
+		 * system call (alarm() counts whole seconds only).
+		 */
+		if (s_tick_us != s_min_slice_us)
+		{
+			struct itimerval itv;
+
+			itv.it_interval.tv_sec = s_min_slice_us / 1000000;
+			itv.it_interval.tv_usec = s_min_slice_us % 1000000;
+			itv.it_value = itv.it_interval;
+			setitimer(ITIMER_REAL, &itv, NULL);
+
+			s_tick_us = s_min_slice_us;
+		}
+
+		s_ticks_left = (slice_us + s_tick_us - 1) / s_tick_us;
+	}
+	else
+	{
+		/* Replaces the periodic timer, if there was one */
+		s_tick_us = 0;
+		alarm(QUANTOM_SEC);
+	}
+}
+
+int ut_set_adaptive_slices(unsigned long min_us, unsigned long max_us)
+{
+	/* Turned off */
+	if (min_us == 0)
+	{
+		s_min_slice_us = 0;
+		s_max_slice_us = 0;
+		return 0;
+	}
+
+	if (max_us < min_us)
+	{
+		return SYS_ERR;
+	}
+
+	s_max_slice_us = max_us;
+	s_min_slice_us = min_us;
+
+	return 0;
+}
+
+void account_switch_cycles()
+{
+	unsigned long cycles = read_cycles() - s_switch_start_cycles;
+
+	ut_hist_record(&s_threads_info[s_current_thread_id + 1].sched_stats.switch_cycles,
+				   cycles);
+	ut_hist_record(&s_sched_stats.switch_cycles, cycles);
+}
+
+int ut_get_sched_stats(tid_t tid, ut_sched_stats_t *stats)
+{
+	/* Must have where to copy to */
+	if (stats == NULL) return SYS_ERR;
+
+	/* Don't access illegal memory */
+	if (tid < SYS_ERR || tid >= (tid_t)s_num_spawned_threads)
+	{
+		return SYS_ERR;
+	}
+
+	/* The scheduler won't update them while copying */
+	ut_preempt_disable();
+
+	if (tid == SYS_ERR)
+	{
+		*stats = s_sched_stats;
+	}
+	else
+	{
+		*stats = s_threads_info[tid + 1].sched_stats;
+	}
+
+	ut_preempt_enable();
+
+	return 0;
+}
+
+unsigned long ut_hist_percentile(const ut_hist_t *hist, unsigned int percent)
+{
+	unsigned long wanted;
+	unsigned long seen = 0;
+	unsigned int bucket;
+
+	if (hist == NULL || hist->count == 0) return 0;
+
+	/* At least one value */
+	wanted = (hist->count * percent + 99) / 100;
+	if (wanted == 0) wanted = 1;
+
+	for (bucket = 0; bucket < UT_HIST_BUCKETS; ++bucket)
+	{
+		unsigned long low, high, offset, estimate;
+		double spread;
+
+		if (seen + hist->buckets[bucket] < wanted)
+		{
+			seen += hist->buckets[bucket];
+			continue;
+		}
+
+		/* The values the bucket may hold, the top one has no bound */
+		low = bucket == 0 ? 0 : 1UL << (bucket - 1);
+		high = bucket == UT_HIST_BUCKETS - 1 ? hist->max : (1UL << bucket) - 1;
+
+		/* Spread evenly over the bucket, its last value at the top.
+		 * Rounded in a double, the offset might pass the top.
+		 */
+		spread = (double)(high - low) * (wanted - seen) / hist->buckets[bucket];
+		offset = spread < (double)(high - low) ? (unsigned long)spread : high - low;
+		estimate = low + offset;
+
+		return estimate < hist->max ? estimate : hist->max;
+	}
+
+	return hist->max;
+}
+
+unsigned int init_scheduler()
+{
+	struct sigaction sa;
+	stack_t ss;
+
+	/* The handlers' stack and the switching context,
+	 * allocated once.
+	 */
+	if (s_sig_stack == NULL)
+	{
+		s_sig_stack = malloc(SCHED_STACK_SIZE);
+		s_switch_stack = malloc(SCHED_STACK_SIZE);
+		if (s_sig_stack == NULL || s_switch_stack == NULL) return SYS_ERR;
+
+		if (getcontext(&s_switch_context) == SYS_ERR) return SYS_ERR;
+		s_switch_context.uc_link = NULL;
+		s_switch_context.uc_stack.ss_sp = s_switch_stack;
+		s_switch_context.uc_stack.ss_size = SCHED_STACK_SIZE;
+
+		/* No handler may run on top of the frames being moved */
+		if (sigfillset(&s_switch_context.uc_sigmask) == SYS_ERR) return SYS_ERR;
+
+		makecontext(&s_switch_context, switch_threads, 0);
+	}
+
+	ss.ss_sp = s_sig_stack;
+	ss.ss_size = SCHED_STACK_SIZE;
+	ss.ss_flags = 0;
+	if (sigaltstack(&ss, NULL) < 0) return SYS_ERR;
+
+	/* Prepare the scheduler's handler struct */
+	sa.sa_flags = SA_RESTART | SA_SIGINFO | SA_ONSTACK;
+	if (sigfillset(&sa.sa_mask) == SYS_ERR) return SYS_ERR;
+	sa.sa_sigaction = scheduler_tick;
+
+	/* Set the 'scheduler' signal */
+	if (sigaction(SIGALRM, &sa, NULL) < 0) return SYS_ERR;
+
+	return 0;
+}
+
+void switch_threads()
+{
+	ut_thread_info_t *pFrom = &s_threads_info[s_switch_from + 1];
+	ut_thread_info_t *pTo = &s_threads_info[s_switch_to + 1];
+	char *pTop = s_sig_stack + SCHED_STACK_SIZE;
+	char *pLow = sig_frames_low(&s_threads[s_switch_from + 1].uc);
+
+	/* The outgoing thread resumes inside its handlers,
+	 * keep their frames until it does.
+	 */
+	if (pFrom->pSigFrames == NULL)
+	{
+		/* Only the touched pages are ever backed */
+		pFrom->pSigFrames = mmap(NULL, SCHED_STACK_SIZE,
+								 PROT_READ | PROT_WRITE,
+								 MAP_PRIVATE | MAP_ANONYMOUS,
+								 -1, 0);
+		if (pFrom->pSigFrames == MAP_FAILED)
+		{
+			perror("scheduler\n");
+			exit(1);
+		}
+	}
+
+	pFrom->sig_frames_size = pTop - pLow;
+	memcpy(pFrom->pSigFrames, pLow, pFrom->sig_frames_size);
+
+	/* Back to where they were. A thread's first run has none. */
+	if (pTo->sig_frames_size != 0)
+	{
+		memcpy(pTop - pTo->sig_frames_size, pTo->pSigFrames,
+			   pTo->sig_frames_size);
+	}
+
+	setcontext(&s_threads[s_switch_to + 1].uc);
+
+	/* Critical error.. */
+	perror("scheduler\n");
+	exit(1);
+}
+
+char *sig_frames_low(ucontext_t *pContext)
+{
+	uintptr_t low = (uintptr_t)s_sig_stack;
+	uintptr_t sp = low;
+
+#if defined(__x86_64__)
+	sp = pContext->uc_mcontext.gregs[REG_RSP] - SCHED_RED_ZONE;
+#elif defined(__i386__)
+	sp = pContext->uc_mcontext.gregs[REG_ESP] - SCHED_RED_ZONE;
+#endif
+
+	/* Within the alternate stack */
+	if (sp < low)
+	{
+		return s_sig_stack;
+	}
+	if (sp - low > SCHED_STACK_SIZE)
+	{
+		return s_sig_stack + SCHED_STACK_SIZE;
+	}
+
+	return s_sig_stack + (sp - low);
+}
+
+void scheduler_tick(int signal, siginfo_t *pSigInfo, void *pContext)
+{
+	/* A tick of the slices' timer, and the quantum goes on.
+	 * ut_yield()'s kill() always switches.
+	 */
+	if (pSigInfo->si_code != SI_USER &&
+		s_tick_us != 0 &&
+		s_ticks_left > 1)
+	{
+		s_ticks_left--;
+		return;
+	}
+
+	scheduler(signal);
+}
+
+void profiler(int signal)
+{
+	// Make sure thread table allocated
+	if (s_threads == NULL)
+	{
+		errno = 1;
+		perror("profiler cannot access thread table as it doesn't exist.\n");
 		exit(1);
 	}
 
 	// Update the current running thread's run counter
 	s_threads[s_current_thread_id].vtime += PROFILER_INTERVAL_MSEC;
+
+	publish_stats();
+
+	/* The group's budget is used up, let the others run.
+	 * Injected requests are handled on the switch too.
+	 */
+	if (group_charge(s_current_thread_id, PROFILER_INTERVAL_USEC) ||
+		inject_pending())
+	{
+		ut_yield();
+	}
+}
+
+void publish_stats()
+{
+	tid_t tid;
+	unsigned int num_ready = 0;
+
+	for (tid = 0; tid < s_num_spawned_threads; ++tid)
+	{
+		ut_thread_info_t *pInfo = &s_threads_info[tid + 1];
+
+		/* Everyone but the running thread waits for the CPU */
+		if (pInfo->state == THREAD_READY && tid != s_current_thread_id)
+		{
+			num_ready++;
+		}
+
+		ut_stats_publish_thread(tid,
+								ut_get_vtime(tid),
+								pInfo->switches,
+								pInfo->state == THREAD_FINISHED);
+	}
+
+	ut_stats_publish_global(s_num_spawned_threads, num_ready);
 }
 
 int init_profiler()
@@ -286,8 +2142,11 @@ int init_profiler()
 	struct itimerval itv;
 	struct sigaction sa;
 
-	/* Initialize the data structures for SIGVTALRM handling. */
-	sa.sa_flags = SA_RESTART;
+	/* Initialize the data structures for SIGVTALRM handling.
+	 * Runs on the scheduler's stack, the threads' stacks only
+	 * hold their own frames.
+	 */
+	sa.sa_flags = SA_RESTART | SA_ONSTACK;
 	if (sigfillset(&sa.sa_mask) == SYS_ERR) return SYS_ERR;
 	sa.sa_handler = profiler;
 
@@ -320,12 +2179,15 @@ int prepare_all_threads()
 	{
 		ut_slot pCurrThread = &s_threads[i];
 
+		/* Couldn't be set up, never runs */
+		if (s_threads_info[i].state == THREAD_FINISHED) continue;
+
 		/* Start the current thread */
 		errno = 0;
 		makecontext(&pCurrThread->uc,
-					(void(*)(void))pCurrThread->func,
+					(void(*)(void))thread_entry,
 					1, /* Single argument */
-					pCurrThread->arg);
+					i);
 
 		/* Make sure it started correctly */
 		if (errno != 0)
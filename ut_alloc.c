@@ -0,0 +1,315 @@
+/*
+ * ut_alloc.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ut_alloc.h"
+#include "ut_sched.h"
+
+/* Internal definitions */
+#define CHUNK_SIZE (64 * 1024)
+#define MIN_CLASS_SHIFT (5)  /* Smallest block is 32 bytes (header included) */
+#define NUM_CLASSES (8)      /* 32, 64, ..., 4096 */
+#define LARGE_CLASS (NUM_CLASSES)
+#define HEADER_MAGIC (0x7574)
+#define MAX_ARENAS (MAX_TAB_SIZE + 1)
+
+/* Every block starts with this header, sized to keep
+ * the payload aligned to UT_ALLOC_ALIGN. */
+typedef struct _block_header {
+	unsigned short magic;
+	unsigned short size_class;
+	unsigned short owner;     /* Arena index (slot) */
+	unsigned short reserved;
+	size_t large_size;        /* Mapped size, for large blocks only */
+} block_header_t;
+
+/* A free block reuses its payload as the list link */
+typedef struct _free_block {
+	struct _free_block *next;
+} free_block_t;
+
+/* A chunk keeps the link to the previous chunk in its first bytes */
+typedef struct _chunk {
+	struct _chunk *next;
+} chunk_t;
+
+typedef struct _arena {
+	char *bump;
+	char *bump_end;
+	chunk_t *chunks;
+	free_block_t *free_lists[NUM_CLASSES];
+	/* Blocks freed by other threads, pushed lock-free */
+	free_block_t * volatile remote_free;
+} arena_t;
+
+/* Arena 0 belongs to the main context, arena (tid + 1) to thread tid */
+static arena_t s_arenas[MAX_ARENAS];
+
+/* Internal functions */
+
+/**
+ * Returns the arena index of the running thread.
+ */
+unsigned int current_arena();
+
+/**
+ * Translates an allocation size (header included)
+ * into its size class.
+ * @param total Bytes needed, including the header
+ * @return The class index
+ */
+unsigned int size_to_class(size_t total);
+
+/**
+ * Moves the blocks other threads freed into the local
+ * free lists of the arena.
+ * @param pArena Arena owned by the caller
+ */
+void drain_remote_frees(arena_t *pArena);
+
+/**
+ * Maps a new chunk and makes it the arena's bump region.
+ * @param pArena Arena owned by the caller
+ * @return 0 - Success
+ * 		   SYS_ERR - On any failure
+ */
+int add_chunk(arena_t *pArena);
+
+/**
+ * Serves a block too big for the arena straight from mmap.
+ * @param total Bytes needed, including the header
+ * @return Pointer to the header, NULL on failure
+ */
+block_header_t *alloc_large(size_t total);
+
+/* Implementations */
+unsigned int current_arena()
+{
+	tid_t tid = ut_self();
+
+	/* The main context has its own arena */
+	if (tid < 0)
+	{
+		return 0;
+	}
+
+	return tid + 1;
+}
+
+unsigned int size_to_class(size_t total)
+{
+	unsigned int size_class = 0;
+
+	/* Find the smallest power of two which holds the block */
+	while (((size_t)1 << (size_class + MIN_CLASS_SHIFT)) < total)
+	{
+		size_class++;
+	}
+
+	return size_class;
+}
+
+void drain_remote_frees(arena_t *pArena)
+{
+	free_block_t *pBlock;
+
+	/* Take the whole list at once, so no one else
+	 * ever pops from it (no ABA problem).
+	 */
+	pBlock = __sync_lock_test_and_set(&pArena->remote_free, NULL);
+
+	while (pBlock != NULL)
+	{
+		free_block_t *pNext = pBlock->next;
+		block_header_t *pHeader = (block_header_t *)pBlock - 1;
+
+		pBlock->next = pArena->free_lists[pHeader->size_class];
+		pArena->free_lists[pHeader->size_class] = pBlock;
+
+		pBlock = pNext;
+	}
+}
+
+int add_chunk(arena_t *pArena)
+{
+	chunk_t *pChunk = mmap(NULL, CHUNK_SIZE,
+						   PROT_READ | PROT_WRITE,
+						   MAP_PRIVATE | MAP_ANONYMOUS,
+						   -1, 0);
+
+	if (pChunk == MAP_FAILED)
+	{
+		return SYS_ERR;
+	}
+
+	/* Link it so a reset can unmap it later */
+	pChunk->next = pArena->chunks;
+	pArena->chunks = pChunk;
+
+	/* The first block starts after the link, keeping the alignment */
+	pArena->bump = (char *)pChunk + UT_ALLOC_ALIGN;
+	pArena->bump_end = (char *)pChunk + CHUNK_SIZE;
+
+	return 0;
+}
+
+block_header_t *alloc_large(size_t total)
+{
+	block_header_t *pHeader = mmap(NULL, total,
+								   PROT_READ | PROT_WRITE,
+								   MAP_PRIVATE | MAP_ANONYMOUS,
+								   -1, 0);
+
+	if (pHeader == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	pHeader->size_class = LARGE_CLASS;
+	pHeader->large_size = total;
+
+	return pHeader;
+}
+
+void *ut_alloc(size_t size)
+{
+	size_t total;
+	unsigned int arena_index = current_arena();
+	arena_t *pArena = &s_arenas[arena_index];
+	block_header_t *pHeader;
+	unsigned int size_class;
+	size_t block_size;
+
+	/* No room for the header, the total would wrap around */
+	if (size > SIZE_MAX - sizeof(block_header_t))
+	{
+		return NULL;
+	}
+	total = size + sizeof(block_header_t);
+
+	/* Too big for the arena */
+	if (size > UT_ALLOC_MAX_SMALL)
+	{
+		pHeader = alloc_large(total);
+		if (pHeader == NULL) return NULL;
+
+		pHeader->magic = HEADER_MAGIC;
+		pHeader->owner = arena_index;
+		return pHeader + 1;
+	}
+
+	size_class = size_to_class(total);
+	block_size = (size_t)1 << (size_class + MIN_CLASS_SHIFT);
+
+	/* Pick up what other threads gave back */
+	if (pArena->free_lists[size_class] == NULL &&
+		pArena->remote_free != NULL)
+	{
+		drain_remote_frees(pArena);
+	}
+
+	/* Reuse a freed block of the same class */
+	if (pArena->free_lists[size_class] != NULL)
+	{
+		free_block_t *pBlock = pArena->free_lists[size_class];
+		pArena->free_lists[size_class] = pBlock->next;
+
+		/* The header is kept intact while the block is free */
+		return pBlock;
+	}
+
+	/* Otherwise cut a new one from the bump region */
+	if (pArena->bump + block_size > pArena->bump_end)
+	{
+		if (add_chunk(pArena) != 0) return NULL;
+	}
+
+	pHeader = (block_header_t *)pArena->bump;
+	pArena->bump += block_size;
+
+	pHeader->magic = HEADER_MAGIC;
+	pHeader->size_class = size_class;
+	pHeader->owner = arena_index;
+
+	return pHeader + 1;
+}
+
+void ut_free(void *ptr)
+{
+	block_header_t *pHeader;
+	free_block_t *pBlock = ptr;
+	arena_t *pOwner;
+
+	/* Nothing to free */
+	if (ptr == NULL) return;
+
+	pHeader = (block_header_t *)ptr - 1;
+
+	/* Not one of ours (or freed twice after a reset) */
+	if (pHeader->magic != HEADER_MAGIC) return;
+
+	/* Large blocks go straight back to the system */
+	if (pHeader->size_class == LARGE_CLASS)
+	{
+		pHeader->magic = 0;
+		munmap(pHeader, pHeader->large_size);
+		return;
+	}
+
+	pOwner = &s_arenas[pHeader->owner];
+
+	/* Our own block, no one else touches our free lists */
+	if (pHeader->owner == current_arena())
+	{
+		pBlock->next = pOwner->free_lists[pHeader->size_class];
+		pOwner->free_lists[pHeader->size_class] = pBlock;
+		return;
+	}
+
+	/* Someone else's block, push it on the owner's remote list.
+	 * The compare-and-swap is a single instruction, so being
+	 * preempted in the middle just means trying again.
+	 */
+	do
+	{
+		pBlock->next = pOwner->remote_free;
+	} while (!__sync_bool_compare_and_swap(&pOwner->remote_free,
+										   pBlock->next,
+										   pBlock));
+}
+
+void ut_alloc_reset(tid_t tid)
+{
+	arena_t *pArena;
+	chunk_t *pChunk;
+
+	/* Don't access illegal memory */
+	if (tid < SYS_ERR || tid + 1 >= MAX_ARENAS)
+	{
+		return;
+	}
+
+	pArena = &s_arenas[tid + 1];
+
+	/* Forget about blocks given back by others */
+	(void)__sync_lock_test_and_set(&pArena->remote_free, NULL);
+
+	/* Return every chunk to the system */
+	pChunk = pArena->chunks;
+	while (pChunk != NULL)
+	{
+		chunk_t *pNext = pChunk->next;
+		munmap(pChunk, CHUNK_SIZE);
+		pChunk = pNext;
+	}
+
+	memset(pArena, 0, sizeof(*pArena));
+}
@@ -0,0 +1,63 @@
+/*
+ * ut_alloc.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  A memory allocator for user-level threads.
+ *  Calling malloc() from a thread isn't safe - the scheduler might
+ *  preempt the thread while glibc holds the allocator lock, and the
+ *  next thread to call malloc() will deadlock the process.
+ *  Instead, every thread owns a private arena: small blocks are cut
+ *  from a bump region and recycled through per size-class free lists.
+ *  Since only the owner ever touches its arena, preemption can't leave
+ *  it in an inconsistent state for another thread. Blocks freed by other
+ *  threads are handed back to the owner through a lock-free list.
+ */
+
+#ifndef _UT_ALLOC_H
+#define _UT_ALLOC_H
+
+#include <stddef.h>
+
+#include "ut.h"
+
+#define UT_ALLOC_ALIGN 16        // alignment of every returned block.
+#define UT_ALLOC_MAX_SMALL 4080  // largest request served from the arena.
+
+/*****************************************************************************
+ Allocates a memory block for the calling thread. Small requests (up to
+ UT_ALLOC_MAX_SMALL bytes) are served from the thread's arena, larger ones
+ are mapped directly from the system.
+ May be called from the main context (before ut_start()) as well.
+ Must NOT be called from a signal handler.
+
+ Parameters:
+    size - the number of bytes needed.
+
+ Returns:
+    pointer to the block (aligned to UT_ALLOC_ALIGN) - on success.
+    NULL - on system failure.
+ ****************************************************************************/
+void *ut_alloc(size_t size);
+
+/*****************************************************************************
+ Frees a block previously returned by ut_alloc(). The block may be freed by
+ any thread, not only the one that allocated it. Freeing a block after its
+ owner thread has finished is not allowed (its arena no longer exists).
+
+ Parameters:
+    ptr - the block to free. NULL is ignored.
+ ****************************************************************************/
+void ut_free(void *ptr);
+
+/*****************************************************************************
+ Releases the whole arena of the given thread at once - every small block it
+ allocated becomes invalid. Called automatically when a thread finishes.
+
+ Parameters:
+    tid - a thread ID, or SYS_ERR for the main context's arena.
+ ****************************************************************************/
+void ut_alloc_reset(tid_t tid);
+
+#endif
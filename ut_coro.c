@@ -0,0 +1,469 @@
+/*
+ * ut_coro.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "ut_coro.h"
+#include "ut_sched.h"
+#include "ut_alloc.h"
+
+/* Internal definitions */
+#define WHEEL_SIZE (1024) /* Timer wheel slots, one per msec */
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WAIT_BUCKETS_SHIFT (12)
+#define WAIT_BUCKETS (1 << WAIT_BUCKETS_SHIFT) /* Wait lists' hash table size */
+#define IDLE_WAIT_MSEC (1000) /* Blocked for good, an idle carrier would look deadlocked */
+
+/* A FIFO of coroutines linked through their 'next' field */
+typedef struct _coro_list {
+	ut_coro_t *head;
+	ut_coro_t *tail;
+} coro_list_t;
+
+/* The coroutines waiting for a semaphore, in FIFO order */
+typedef struct _coro_wait_list {
+	struct _coro_wait_list *next;  /* Next in the hash bucket */
+	sem_t *sem;
+	coro_list_t waiters;
+} coro_wait_list_t;
+
+/* Global structures */
+static ut_coro_t * volatile s_incoming = NULL;
+static ut_coro_t * volatile s_woken = NULL; /* Granted their semaphore */
+static coro_list_t s_ready;
+static coro_wait_list_t *s_wait_lists[WAIT_BUCKETS];
+static ut_coro_t *s_wheel[WHEEL_SIZE];
+static unsigned long s_wheel_time = 0;
+static unsigned long s_num_sleeping = 0;  /* In the wheel */
+static volatile int s_carrier_idle = 0;   /* Waiting on it for work */
+
+/* Internal functions */
+
+/**
+ * Appends a coroutine to the end of a list.
+ */
+void list_push(coro_list_t *pList, ut_coro_t *co);
+
+/**
+ * Detaches the whole list, leaving it empty.
+ * @return The first coroutine of the old list
+ */
+ut_coro_t *list_take(coro_list_t *pList);
+
+/**
+ * Pushes a coroutine on a stack shared with other threads.
+ */
+void stack_push(ut_coro_t * volatile *ppStack, ut_coro_t *co);
+
+/**
+ * Moves the whole shared stack to the ready list,
+ * in the order it was pushed.
+ */
+void take_stack(ut_coro_t * volatile *ppStack);
+
+/**
+ * Wakes the carrier, if it's idle.
+ */
+void wake_carrier();
+
+/**
+ * Returns the hash bucket of a semaphore's wait list.
+ */
+coro_wait_list_t **wait_bucket(sem_t *s);
+
+/**
+ * Makes a coroutine wait for its semaphore, unless
+ * the semaphore was raised since it tried.
+ * Called with preemption disabled.
+ */
+void wait_sem(ut_coro_t *co);
+
+/**
+ * Puts a sleeping coroutine in the timer wheel.
+ */
+void wheel_add(ut_coro_t *co);
+
+/**
+ * Moves every coroutine whose time has come
+ * to the ready list.
+ */
+void poll_wheel();
+
+/**
+ * Returns when the first sleeping coroutine is due
+ * (there must be one).
+ */
+unsigned long wheel_next_wake();
+
+/**
+ * Waits until a coroutine is spawned or woken, or
+ * the first sleeping one is due.
+ */
+void carrier_wait();
+
+/**
+ * Runs every ready coroutine once and files it
+ * according to what it is waiting for.
+ */
+void run_ready();
+
+/**
+ * Main loop of the carrier thread.
+ * @param arg Unused
+ */
+void coro_carrier(int arg);
+
+/* Implementations */
+void list_push(coro_list_t *pList, ut_coro_t *co)
+{
+	co->next = NULL;
+
+	if (pList->tail == NULL)
+	{
+		pList->head = co;
+	}
+	else
+	{
+		pList->tail->next = co;
+	}
+
+	pList->tail = co;
+}
+
+ut_coro_t *list_take(coro_list_t *pList)
+{
+	ut_coro_t *co = pList->head;
+
+	pList->head = NULL;
+	pList->tail = NULL;
+
+	return co;
+}
+
+unsigned long ut_coro_now_ms(void)
+{
+	/* Same clock as the threads, so simulations cover coroutines too */
+	return ut_now_ms();
+}
+
+void stack_push(ut_coro_t * volatile *ppStack, ut_coro_t *co)
+{
+	/* Only the carrier pops (the whole stack at once),
+	 * so no ABA problem.
+	 */
+	do
+	{
+		co->next = *ppStack;
+	} while (!__sync_bool_compare_and_swap(ppStack, co->next, co));
+
+	wake_carrier();
+}
+
+void wake_carrier()
+{
+	if (s_carrier_idle)
+	{
+		ut_preempt_disable();
+		ut_wake_one((void *)&s_carrier_idle, 0);
+		ut_preempt_enable();
+	}
+}
+
+void take_stack(ut_coro_t * volatile *ppStack)
+{
+	ut_coro_t *co = __sync_lock_test_and_set(ppStack, NULL);
+	ut_coro_t *pReversed = NULL;
+
+	/* The stack is newest first, reverse it */
+	while (co != NULL)
+	{
+		ut_coro_t *pNext = co->next;
+		co->next = pReversed;
+		pReversed = co;
+		co = pNext;
+	}
+
+	while (pReversed != NULL)
+	{
+		ut_coro_t *pNext = pReversed->next;
+		list_push(&s_ready, pReversed);
+		pReversed = pNext;
+	}
+}
+
+void ut_coro_spawn(ut_coro_t *co, ut_coro_fn fn, void *ctx)
+{
+	/* Must be a valid coroutine */
+	if (co == NULL || fn == NULL) return;
+
+	co->fn = fn;
+	co->ctx = ctx;
+	co->line = 0;
+
+	/* The carrier picks it up on its next round */
+	stack_push(&s_incoming, co);
+}
+
+coro_wait_list_t **wait_bucket(sem_t *s)
+{
+	/* Fibonacci hashing of the address */
+	uintptr_t hash = ((uintptr_t)s >> 3) * (uintptr_t)0x9E3779B97F4A7C15ULL;
+
+	return &s_wait_lists[hash >> (sizeof(uintptr_t) * 8 - WAIT_BUCKETS_SHIFT)];
+}
+
+void wait_sem(ut_coro_t *co)
+{
+	coro_wait_list_t **ppBucket = wait_bucket(co->wait.sem);
+	coro_wait_list_t *pList = *ppBucket;
+
+	/* Raised after the coroutine tried, take it now */
+	if (__sync_lock_test_and_set(co->wait.sem, 0) != 0)
+	{
+		list_push(&s_ready, co);
+		return;
+	}
+
+	while (pList != NULL && pList->sem != co->wait.sem)
+	{
+		pList = pList->next;
+	}
+
+	/* First waiter of this semaphore */
+	if (pList == NULL)
+	{
+		pList = ut_alloc(sizeof(*pList));
+		if (pList == NULL)
+		{
+			/* No memory, try again on the next round */
+			list_push(&s_ready, co);
+			return;
+		}
+
+		pList->sem = co->wait.sem;
+		pList->waiters.head = NULL;
+		pList->waiters.tail = NULL;
+		pList->next = *ppBucket;
+		*ppBucket = pList;
+	}
+
+	list_push(&pList->waiters, co);
+}
+
+int ut_coro_sem_up(sem_t *s)
+{
+	coro_wait_list_t **ppList = wait_bucket(s);
+	coro_wait_list_t *pList;
+	ut_coro_t *co;
+
+	while (*ppList != NULL && (*ppList)->sem != s)
+	{
+		ppList = &(*ppList)->next;
+	}
+
+	/* No coroutine waits for it */
+	if (*ppList == NULL) return 0;
+
+	pList = *ppList;
+	co = pList->waiters.head;
+	pList->waiters.head = co->next;
+
+	/* Was the last one */
+	if (pList->waiters.head == NULL)
+	{
+		*ppList = pList->next;
+		ut_free(pList);
+	}
+
+	/* It resumes owning the semaphore */
+	stack_push(&s_woken, co);
+
+	return 1;
+}
+
+void wheel_add(ut_coro_t *co)
+{
+	unsigned long slot = co->wait.wake_ms;
+
+	/* Already due, don't wait for a full turn of the wheel */
+	if (slot < s_wheel_time)
+	{
+		slot = s_wheel_time;
+	}
+
+	co->next = s_wheel[slot & WHEEL_MASK];
+	s_wheel[slot & WHEEL_MASK] = co;
+	s_num_sleeping++;
+}
+
+void poll_wheel()
+{
+	unsigned long now = ut_coro_now_ms();
+	unsigned long steps = 0;
+
+	/* Go over the slots passed since the last poll
+	 * (the whole wheel at most).
+	 */
+	while (s_wheel_time <= now && steps < WHEEL_SIZE)
+	{
+		ut_coro_t **ppSlot = &s_wheel[s_wheel_time & WHEEL_MASK];
+		ut_coro_t *co = *ppSlot;
+
+		*ppSlot = NULL;
+
+		while (co != NULL)
+		{
+			ut_coro_t *pNext = co->next;
+
+			/* Due now, or on a later turn of the wheel */
+			if (co->wait.wake_ms <= now)
+			{
+				list_push(&s_ready, co);
+				s_num_sleeping--;
+			}
+			else
+			{
+				co->next = *ppSlot;
+				*ppSlot = co;
+			}
+
+			co = pNext;
+		}
+
+		s_wheel_time++;
+		steps++;
+	}
+
+	/* Skipped over full turns, resume from the current time */
+	if (s_wheel_time <= now)
+	{
+		s_wheel_time = now;
+	}
+}
+
+unsigned long wheel_next_wake()
+{
+	unsigned long earliest = 0;
+	int found = 0;
+	unsigned long steps;
+
+	/* The first slot with a coroutine due on this turn of the
+	 * wheel has the earliest; others are due on later turns.
+	 */
+	for (steps = 0; steps < WHEEL_SIZE; ++steps)
+	{
+		unsigned long slot_time = s_wheel_time + steps;
+		ut_coro_t *co;
+
+		for (co = s_wheel[slot_time & WHEEL_MASK]; co != NULL; co = co->next)
+		{
+			if (co->wait.wake_ms <= slot_time)
+			{
+				return slot_time;
+			}
+
+			if (!found || co->wait.wake_ms < earliest)
+			{
+				found = 1;
+				earliest = co->wait.wake_ms;
+			}
+		}
+	}
+
+	return earliest;
+}
+
+void carrier_wait()
+{
+	unsigned long wait_ms = IDLE_WAIT_MSEC;
+
+	if (s_num_sleeping > 0)
+	{
+		unsigned long next_wake = wheel_next_wake();
+		unsigned long now = ut_coro_now_ms();
+
+		/* Due already */
+		if (next_wake <= now) return;
+
+		wait_ms = next_wake - now;
+	}
+
+	/* Checked in a critical section, so no spawn or wake up is missed */
+	ut_preempt_disable();
+	if (s_incoming == NULL && s_woken == NULL)
+	{
+		s_carrier_idle = 1;
+		ut_wait_timeout((void *)&s_carrier_idle, wait_ms);
+		s_carrier_idle = 0;
+	}
+	ut_preempt_enable();
+}
+
+void run_ready()
+{
+	ut_coro_t *co = list_take(&s_ready);
+
+	while (co != NULL)
+	{
+		ut_coro_t *pNext = co->next;
+
+		switch (co->fn(co))
+		{
+		case UT_CORO_READY:
+			list_push(&s_ready, co);
+			break;
+		case UT_CORO_BLOCKED:
+			/* No up() may slip between the check and the wait */
+			ut_preempt_disable();
+			wait_sem(co);
+			ut_preempt_enable();
+			break;
+		case UT_CORO_SLEEPING:
+			wheel_add(co);
+			break;
+		default:
+			/* Done, forget about it */
+			break;
+		}
+
+		co = pNext;
+	}
+}
+
+void coro_carrier(int arg)
+{
+	s_wheel_time = ut_coro_now_ms();
+
+	while (1)
+	{
+		take_stack(&s_incoming);
+		take_stack(&s_woken);
+		poll_wheel();
+
+		/* Nothing to run, let the threads run */
+		if (s_ready.head == NULL)
+		{
+			carrier_wait();
+			continue;
+		}
+
+		run_ready();
+	}
+}
+
+int ut_coro_init(void)
+{
+	tid_t tid = ut_spawn_thread(coro_carrier, 0);
+
+	if (tid < 0)
+	{
+		return tid;
+	}
+
+	return 0;
+}
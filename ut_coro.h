@@ -0,0 +1,140 @@
+/*
+ * ut_coro.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Stackless coroutines for tiny tasks.
+ *  A coroutine doesn't own a stack - it is a plain function which
+ *  returns whenever it has to wait, and resumes from the same point
+ *  the next time it is called (using a switch on the line number, so
+ *  local variables are NOT kept across a wait - keep state in ctx).
+ *  All the coroutines are run by a single carrier thread, scheduled
+ *  like any other thread, so a coroutine costs only sizeof(ut_coro_t).
+ *  While none is ready, the carrier blocks until one is spawned, gets
+ *  its semaphore or is due to wake up.
+ *
+ *  Usage:
+ *    int my_coro(ut_coro_t *co)
+ *    {
+ *        UT_CORO_BEGIN(co);
+ *        UT_CORO_WAIT_SEM(co, &sem);
+ *        UT_CORO_SLEEP(co, 100);
+ *        UT_CORO_END(co);
+ *    }
+ */
+
+#ifndef _UT_CORO_H
+#define _UT_CORO_H
+
+#include "ut.h"
+#include "binsem.h"
+
+/* Coroutine function return values, set by the macros below */
+#define UT_CORO_DONE 0      // finished, won't run again.
+#define UT_CORO_READY 1     // yielded, run again on the next round.
+#define UT_CORO_BLOCKED 2   // waiting for a semaphore.
+#define UT_CORO_SLEEPING 3  // waiting for a timer.
+
+typedef struct _ut_coro ut_coro_t;
+
+/* A coroutine function, returns one of the values above */
+typedef int (*ut_coro_fn)(ut_coro_t *co);
+
+/* The coroutine's state. Allocated by the user, must stay valid
+   until the coroutine is done. */
+struct _ut_coro {
+	ut_coro_t *next;            // intrusive link, used by the carrier.
+	ut_coro_fn fn;              // the coroutine function.
+	void *ctx;                  // the user's context.
+	union {
+		sem_t *sem;             // the semaphore waited for.
+		unsigned long wake_ms;  // the time to wake up at.
+	} wait;
+	unsigned int line;          // the resume point.
+};
+
+#define UT_CORO_BEGIN(co) \
+	switch ((co)->line) { case 0:
+
+#define UT_CORO_END(co) \
+	} (co)->line = 0; return UT_CORO_DONE
+
+/* Let other coroutines (and threads) run */
+#define UT_CORO_YIELD(co) \
+	do { \
+		(co)->line = __LINE__; \
+		return UT_CORO_READY; \
+		case __LINE__:; \
+	} while (0)
+
+/* The down() operation. The coroutine waits in the semaphore's wait
+   list until binsem_up() hands it the semaphore, so it resumes only
+   once it owns it. Swaps like binsem_down() (sem_t is 8 bytes). */
+#define UT_CORO_WAIT_SEM(co, s) \
+	do { \
+		if (__sync_lock_test_and_set((s), 0) == 0) { \
+			(co)->wait.sem = (s); \
+			(co)->line = __LINE__; \
+			return UT_CORO_BLOCKED; \
+			case __LINE__:; \
+		} \
+	} while (0)
+
+/* Sleep for (at least) the given number of milliseconds */
+#define UT_CORO_SLEEP(co, msec) \
+	do { \
+		(co)->wait.wake_ms = ut_coro_now_ms() + (msec); \
+		(co)->line = __LINE__; \
+		return UT_CORO_SLEEPING; \
+		case __LINE__:; \
+	} while (0)
+
+/*****************************************************************************
+ Creates the carrier thread which runs all the coroutines. Must be called
+ after ut_init() and before ut_start().
+
+ Parameters:
+    None.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - on system failure.
+    TAB_FULL - if the threads table is already full.
+ ****************************************************************************/
+int ut_coro_init(void);
+
+/*****************************************************************************
+ Starts a coroutine. May be called from any thread, or from the main context
+ before ut_start(). The coroutine first runs on the carrier's next round.
+
+ Parameters:
+    co - the coroutine's state, allocated by the caller.
+    fn - the coroutine function.
+    ctx - the user's context, available as co->ctx.
+ ****************************************************************************/
+void ut_coro_spawn(ut_coro_t *co, ut_coro_fn fn, void *ctx);
+
+/*****************************************************************************
+ Hands a semaphore to the first coroutine waiting for it, which resumes on
+ the carrier's next round owning the semaphore. Called by binsem_up() with
+ preemption disabled, when no thread waits for the semaphore.
+
+ Parameters:
+    s - the semaphore being raised (its value stays 0).
+
+ Returns:
+    1 - if a coroutine got the semaphore.
+    0 - if no coroutine waits for it.
+ ****************************************************************************/
+int ut_coro_sem_up(sem_t *s);
+
+/*****************************************************************************
+ Returns the clock used by UT_CORO_SLEEP().
+
+ Returns:
+    the current time, in milliseconds.
+ ****************************************************************************/
+unsigned long ut_coro_now_ms(void);
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * ut_log.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "ut_log.h"
+#include "ut_sched.h"
+#include "ut_stats.h"
+
+/* Internal definitions */
+#define RING_MASK (UT_LOG_RING_SIZE - 1)
+#define MAX_RINGS (MAX_TAB_SIZE + 1)
+#define BATCH_LINES (512)  /* Two iovecs (prefix & text) per line */
+#define PREFIX_SIZE (32)
+#define IDLE_WAIT_MSEC (10) /* How soon an idle drainer sees the others are done */
+
+/* A logged line */
+typedef struct _log_entry {
+	unsigned long time_us;
+	short tid;
+	unsigned short len;
+	char text[UT_LOG_LINE_MAX];
+} log_entry_t;
+
+/* A single-producer (the owner thread),
+ * single-consumer (the drainer) ring.
+ */
+typedef struct _log_ring {
+	volatile unsigned long head;  /* Written by the owner */
+	volatile unsigned long tail;  /* Written by the drainer */
+	log_entry_t entries[UT_LOG_RING_SIZE];
+} log_ring_t;
+
+/* Global structures */
+static log_ring_t * volatile s_rings[MAX_RINGS]; /* Ring (tid + 1), 0 for main */
+static int s_log_fd = STDOUT_FILENO;
+static unsigned long s_start_us = 0;
+static volatile unsigned long s_dropped = 0;
+static volatile int s_draining = 0; /* Owns the batch below */
+static volatile int s_drainer_idle = 0; /* Waiting on it for a line */
+static struct iovec s_batch[BATCH_LINES * 2];
+static char s_prefixes[BATCH_LINES][PREFIX_SIZE];
+static unsigned long s_new_tails[MAX_RINGS];
+
+/* Internal functions */
+
+/**
+ * Returns the ring of the calling thread,
+ * mapping it on first use.
+ * @return The ring, NULL on failure
+ */
+log_ring_t *current_ring();
+
+/**
+ * Writes a whole batch, resuming after short writes.
+ * @param pIov The batch's iovecs (modified)
+ * @param count Number of iovecs
+ * @return 0 - Success
+ * 		   SYS_ERR - The file descriptor failed
+ */
+int write_batch(struct iovec *pIov, int count);
+
+/**
+ * Writes a batch of up to BATCH_LINES pending lines
+ * of all the rings. The caller must own s_draining.
+ * @return Number of lines taken off the rings
+ */
+unsigned int drain_rings();
+
+/**
+ * Returns non-zero if a ring holds a line not written yet.
+ */
+int rings_pending();
+
+/**
+ * Drains a batch, unless someone else is draining.
+ * @return Number of lines taken off the rings
+ */
+unsigned int try_drain();
+
+/**
+ * Main loop of the drainer thread.
+ * @param arg Unused
+ */
+void log_drainer(int arg);
+
+/* Implementations */
+log_ring_t *current_ring()
+{
+	unsigned int index = ut_self() + 1;
+	log_ring_t *pRing = s_rings[index];
+
+	/* First line of this thread. Mapped memory is
+	 * zero-filled and doesn't need malloc().
+	 */
+	if (pRing == NULL)
+	{
+		pRing = mmap(NULL, sizeof(log_ring_t),
+					 PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS,
+					 -1, 0);
+
+		if (pRing == MAP_FAILED)
+		{
+			return NULL;
+		}
+
+		s_rings[index] = pRing;
+	}
+
+	return pRing;
+}
+
+void ut_log(const char *fmt, ...)
+{
+	log_ring_t *pRing = current_ring();
+	log_entry_t *pEntry;
+	va_list args;
+	int len;
+
+	if (pRing == NULL) return;
+
+	/* Full, the drainer is behind */
+	if (pRing->head - pRing->tail >= UT_LOG_RING_SIZE)
+	{
+		__sync_fetch_and_add(&s_dropped, 1);
+		return;
+	}
+
+	pEntry = &pRing->entries[pRing->head & RING_MASK];
+	pEntry->time_us = ut_stats_now_us();
+	pEntry->tid = ut_self();
+
+	va_start(args, fmt);
+	len = vsnprintf(pEntry->text, UT_LOG_LINE_MAX, fmt, args);
+	va_end(args);
+
+	/* Truncated, make room for the new line */
+	if (len < 0)
+	{
+		len = 0;
+	}
+	else if (len >= UT_LOG_LINE_MAX)
+	{
+		len = UT_LOG_LINE_MAX - 1;
+	}
+
+	/* Every entry is a full line */
+	if (len == 0 || pEntry->text[len - 1] != '\n')
+	{
+		if (len == UT_LOG_LINE_MAX - 1) len--;
+		pEntry->text[len++] = '\n';
+	}
+	pEntry->len = len;
+
+	/* Publish the entry to the drainer */
+	__sync_synchronize();
+	pRing->head++;
+
+	/* It waits for a line, and may be waiting since before it */
+	if (s_drainer_idle)
+	{
+		ut_wake_one((void *)&s_drainer_idle, 0);
+	}
+}
+
+int write_batch(struct iovec *pIov, int count)
+{
+	while (count > 0)
+	{
+		ssize_t written = writev(s_log_fd, pIov, count);
+
+		if (written < 0)
+		{
+			/* Interrupted, or a non-blocking fd is full */
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN)
+			{
+				if (ut_self() >= 0) ut_yield();
+				continue;
+			}
+
+			return SYS_ERR;
+		}
+
+		/* Skip what was written, a short write resumes mid-line */
+		while (count > 0 && (size_t)written >= pIov->iov_len)
+		{
+			written -= pIov->iov_len;
+			pIov++;
+			count--;
+		}
+
+		if (count > 0)
+		{
+			pIov->iov_base = (char *)pIov->iov_base + written;
+			pIov->iov_len -= written;
+		}
+	}
+
+	return 0;
+}
+
+unsigned int drain_rings()
+{
+	unsigned int num_lines = 0;
+	unsigned int i;
+
+	for (i = 0; i < MAX_RINGS; ++i)
+	{
+		log_ring_t *pRing = s_rings[i];
+		unsigned long pos;
+		unsigned long head;
+
+		s_new_tails[i] = 0;
+		if (pRing == NULL) continue;
+
+		/* Entries up to head are complete */
+		head = pRing->head;
+		__sync_synchronize();
+
+		for (pos = pRing->tail;
+			 pos != head && num_lines < BATCH_LINES;
+			 ++pos)
+		{
+			log_entry_t *pEntry = &pRing->entries[pos & RING_MASK];
+			unsigned long time_us = pEntry->time_us - s_start_us;
+			int prefix_len;
+
+			prefix_len = snprintf(s_prefixes[num_lines], PREFIX_SIZE,
+								  "[%5lu.%06lu] (%d) ",
+								  time_us / 1000000, time_us % 1000000,
+								  pEntry->tid);
+
+			/* Text is written straight from the ring */
+			s_batch[num_lines * 2].iov_base = s_prefixes[num_lines];
+			s_batch[num_lines * 2].iov_len = prefix_len;
+			s_batch[num_lines * 2 + 1].iov_base = pEntry->text;
+			s_batch[num_lines * 2 + 1].iov_len = pEntry->len;
+
+			num_lines++;
+		}
+
+		s_new_tails[i] = pos;
+	}
+
+	if (num_lines == 0) return 0;
+
+	/* A single system call for the whole batch, usually.
+	 * Lines the fd refused are lost, count them.
+	 */
+	if (write_batch(s_batch, num_lines * 2) != 0)
+	{
+		__sync_fetch_and_add(&s_dropped, num_lines);
+	}
+
+	/* Written, the owners may reuse the entries */
+	__sync_synchronize();
+	for (i = 0; i < MAX_RINGS; ++i)
+	{
+		if (s_rings[i] != NULL && s_new_tails[i] != 0)
+		{
+			s_rings[i]->tail = s_new_tails[i];
+		}
+	}
+
+	return num_lines;
+}
+
+int rings_pending()
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_RINGS; ++i)
+	{
+		log_ring_t *pRing = s_rings[i];
+
+		if (pRing != NULL && pRing->head != pRing->tail) return 1;
+	}
+
+	return 0;
+}
+
+unsigned int try_drain()
+{
+	unsigned int num_lines;
+
+	/* Someone is in the middle of a batch */
+	if (__sync_lock_test_and_set(&s_draining, 1))
+	{
+		return 0;
+	}
+
+	num_lines = drain_rings();
+	__sync_lock_release(&s_draining);
+
+	return num_lines;
+}
+
+void log_drainer(int arg)
+{
+	/* The others are done, don't keep ut_start() running */
+	while (ut_num_live_threads() > 1)
+	{
+		if (try_drain() != 0) continue;
+
+		/* Nothing logged, wait for a line. Checked again in a
+		 * critical section, so no line is missed. A flush in the
+		 * middle of a batch is let to end instead.
+		 */
+		ut_preempt_disable();
+		if (rings_pending())
+		{
+			ut_preempt_enable();
+			ut_yield();
+			continue;
+		}
+
+		s_drainer_idle = 1;
+		ut_wait_timeout((void *)&s_drainer_idle, IDLE_WAIT_MSEC);
+		s_drainer_idle = 0;
+		ut_preempt_enable();
+	}
+
+	ut_log_flush();
+}
+
+void ut_log_flush(void)
+{
+	/* Wait for a batch in progress, it uses the same buffers.
+	 * Only a thread can wait, the main context gives up.
+	 */
+	while (__sync_lock_test_and_set(&s_draining, 1))
+	{
+		if (ut_self() < 0) return;
+		ut_yield();
+	}
+
+	/* Until every ring is empty */
+	while (drain_rings() != 0);
+
+	__sync_lock_release(&s_draining);
+}
+
+unsigned long ut_log_dropped(void)
+{
+	return s_dropped;
+}
+
+int ut_log_init(int fd)
+{
+	tid_t tid;
+
+	s_log_fd = fd;
+	s_start_us = ut_stats_now_us();
+
+	tid = ut_spawn_thread(log_drainer, 0);
+	if (tid < 0)
+	{
+		return tid;
+	}
+
+	if (atexit(ut_log_flush) != 0)
+	{
+		return SYS_ERR;
+	}
+
+	return 0;
+}
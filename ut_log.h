@@ -0,0 +1,66 @@
+/*
+ * ut_log.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Asynchronous logging for user-level threads.
+ *  printf() + fflush() is a blocking write() on the only kernel
+ *  thread, which stalls every thread, and stdio isn't safe across
+ *  preemption. ut_log() only formats the line into a private ring of
+ *  the calling thread; a drainer thread collects the lines of all the
+ *  rings and writes them in large batches with writev().
+ */
+
+#ifndef _UT_LOG_H
+#define _UT_LOG_H
+
+#include "ut.h"
+
+#define UT_LOG_LINE_MAX 112      // longer lines are truncated.
+#define UT_LOG_RING_SIZE 256     // lines per thread (must be a power of 2).
+
+/*****************************************************************************
+ Creates the drainer thread, which writes the logged lines to the given file
+ descriptor. Must be called after ut_init() and before ut_start(). The drainer
+ finishes once all the other threads have, so ut_start() still returns. Lines
+ still pending when the process exits are written by an atexit() handler.
+
+ Parameters:
+    fd - the file descriptor to write to (e.g. STDOUT_FILENO).
+
+ Returns:
+    0 - on success.
+    SYS_ERR - on system failure.
+    TAB_FULL - if the threads table is already full.
+ ****************************************************************************/
+int ut_log_init(int fd);
+
+/*****************************************************************************
+ Logs a line, printf() style. The line is prefixed with a timestamp and the
+ TID of the calling thread. If the thread's ring is full, the line is dropped
+ (and counted). Must NOT be called from a signal handler.
+
+ Parameters:
+    fmt - the format string, followed by its arguments.
+ ****************************************************************************/
+void ut_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*****************************************************************************
+ Writes all the pending lines right away, from the calling context. If the
+ drainer is in the middle of a batch, a thread waits for it to end, and the
+ main context returns without writing. Must NOT be called from a signal
+ handler - the handler might have interrupted the drainer.
+
+ Parameters:
+    None.
+ ****************************************************************************/
+void ut_log_flush(void);
+
+/*****************************************************************************
+ Returns the number of lines dropped because a ring was full, or because the
+ file descriptor failed.
+ ****************************************************************************/
+unsigned long ut_log_dropped(void);
+
+#endif
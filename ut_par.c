@@ -0,0 +1,302 @@
+/*
+ * ut_par.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ */
+
+#include "ut_par.h"
+#include "ut_task.h"
+#include "ut_sched.h"
+#include "ut_alloc.h"
+
+/* A parallel loop, shared by all of its pieces */
+typedef struct _par_job {
+	long grain;
+	ut_for_fn for_fn;
+	ut_reduce_fn reduce_fn;
+	ut_combine_fn combine_fn;
+	void *ctx;
+} par_job_t;
+
+/* A piece of the range. The pieces a task posted are
+ * kept in a list, lowest in the range first.
+ */
+typedef struct _par_node par_node_t;
+
+struct _par_node {
+	par_node_t *pNext;
+	par_job_t *pJob;
+	long begin;
+	long end;
+	long result;         /* Value of the piece (reduce only) */
+	ut_latch_t *pJoined; /* Counted down once the piece is done */
+};
+
+/* Internal functions */
+
+/**
+ * Tells whether a latch is open, for ut_task_wait().
+ */
+int latch_open(void *ctx);
+
+/**
+ * Returns the number of iterations in [begin, end), which
+ * doesn't always fit in a long.
+ */
+unsigned long par_span(long begin, long end);
+
+/**
+ * Returns the grain to use for a range.
+ */
+long par_grain(long begin, long end, long grain);
+
+/**
+ * Runs the chunks of [begin, end) in the calling thread.
+ * @return The chunks' values combined (reduce only)
+ */
+long run_chunks(par_job_t *pJob, long begin, long end);
+
+/**
+ * Runs a piece of the range: posts its upper halves to the pool
+ * while it takes them, runs what's left, then waits for the posted
+ * halves on a latch. Only the posted halves are allocated, so the
+ * memory is O(log n) per piece rather than a node per chunk.
+ * @param pNode The piece, gets its value
+ */
+void run_piece(par_node_t *pNode);
+
+/**
+ * Task of a posted piece.
+ * @param arg The piece's node
+ * @return NULL
+ */
+void *par_task(void *arg);
+
+/**
+ * Runs a whole job, in parallel when possible.
+ * @return The value of the range (reduce only)
+ */
+long run_job(par_job_t *pJob, long begin, long end);
+
+/* Implementations */
+void ut_latch_init(ut_latch_t *latch, long count)
+{
+	latch->count = count;
+}
+
+void ut_latch_count_down(ut_latch_t *latch)
+{
+	/* The waiter may be gone with the latch right
+	 * after it opens, don't touch it anymore.
+	 */
+	if (__sync_sub_and_fetch(&latch->count, 1) == 0)
+	{
+		ut_task_notify();
+	}
+}
+
+int latch_open(void *ctx)
+{
+	ut_latch_t *pLatch = ctx;
+
+	return pLatch->count <= 0;
+}
+
+void ut_latch_wait(ut_latch_t *latch)
+{
+	/* Helps the workers, blocks only if there's nothing to do */
+	ut_task_wait(latch_open, latch);
+
+	/* Whatever was done before the count downs is seen */
+	__sync_synchronize();
+}
+
+unsigned long par_span(long begin, long end)
+{
+	/* Wraps around the same way the difference does */
+	return (unsigned long)end - (unsigned long)begin;
+}
+
+long par_grain(long begin, long end, long grain)
+{
+	if (grain > 0)
+	{
+		return grain;
+	}
+
+	grain = par_span(begin, end) / UT_PAR_AUTO_CHUNKS;
+
+	return (grain > 0) ? grain : 1;
+}
+
+long run_chunks(par_job_t *pJob, long begin, long end)
+{
+	long result = 0;
+	int first = 1;
+
+	while (begin < end)
+	{
+		long chunk_end = end;
+
+		/* begin + grain may be past the largest long */
+		if (par_span(begin, end) > (unsigned long)pJob->grain)
+		{
+			chunk_end = begin + pJob->grain;
+		}
+
+		if (pJob->reduce_fn != NULL)
+		{
+			long value = pJob->reduce_fn(begin, chunk_end, pJob->ctx);
+
+			result = first ? value : pJob->combine_fn(result, value, pJob->ctx);
+			first = 0;
+		}
+		else
+		{
+			pJob->for_fn(begin, chunk_end, pJob->ctx);
+		}
+
+		begin = chunk_end;
+	}
+
+	return result;
+}
+
+void run_piece(par_node_t *pNode)
+{
+	par_job_t *pJob = pNode->pJob;
+	par_node_t *pPosted = NULL;
+	ut_latch_t joined;
+	long begin = pNode->begin;
+	long end = pNode->end;
+	long result;
+
+	ut_latch_init(&joined, 0);
+
+	/* Keep the lower half, post the upper one. Only while this
+	 * thread can still run tasks when waiting for them, or the
+	 * halves might wait for each other forever. When the pool
+	 * is full the rest runs here.
+	 */
+	while (par_span(begin, end) > (unsigned long)pJob->grain &&
+		   ut_task_nesting() < UT_TASK_MAX_NESTING)
+	{
+		/* Unsigned, a range may be wider than the largest long */
+		unsigned long span = par_span(begin, end);
+		unsigned long chunks = span / pJob->grain + (span % pJob->grain != 0);
+		long mid = (unsigned long)begin + (chunks / 2) * pJob->grain;
+		par_node_t *pUpper = ut_alloc(sizeof(par_node_t));
+
+		if (pUpper == NULL)
+		{
+			break;
+		}
+
+		pUpper->pJob = pJob;
+		pUpper->begin = mid;
+		pUpper->end = end;
+		pUpper->pJoined = &joined;
+
+		/* Counted before it may be counted down */
+		__sync_fetch_and_add(&joined.count, 1);
+		if (ut_task_try_post(par_task, pUpper) != 0)
+		{
+			__sync_fetch_and_sub(&joined.count, 1);
+			ut_free(pUpper);
+			break;
+		}
+
+		/* Posted last, lowest in the range */
+		pUpper->pNext = pPosted;
+		pPosted = pUpper;
+		end = mid;
+	}
+
+	result = run_chunks(pJob, begin, end);
+
+	/* Join the posted halves, then combine in the range's order */
+	ut_latch_wait(&joined);
+
+	while (pPosted != NULL)
+	{
+		par_node_t *pNext = pPosted->pNext;
+
+		if (pJob->reduce_fn != NULL)
+		{
+			result = pJob->combine_fn(result, pPosted->result, pJob->ctx);
+		}
+
+		ut_free(pPosted);
+		pPosted = pNext;
+	}
+
+	pNode->result = result;
+}
+
+void *par_task(void *arg)
+{
+	par_node_t *pNode = arg;
+
+	run_piece(pNode);
+
+	/* A full barrier, the piece's work is seen before it's done */
+	ut_latch_count_down(pNode->pJoined);
+
+	return NULL;
+}
+
+long run_job(par_job_t *pJob, long begin, long end)
+{
+	par_node_t root;
+
+	/* Only a thread can wait for the pool */
+	if (ut_self() < 0)
+	{
+		return run_chunks(pJob, begin, end);
+	}
+
+	/* The caller takes the whole range */
+	root.pJob = pJob;
+	root.begin = begin;
+	root.end = end;
+	root.pJoined = NULL;
+	run_piece(&root);
+
+	return root.result;
+}
+
+void ut_parallel_for(long begin, long end, long grain,
+					 ut_for_fn fn, void *ctx)
+{
+	par_job_t job;
+
+	/* Nothing to run */
+	if (fn == NULL || begin >= end) return;
+
+	job.grain = par_grain(begin, end, grain);
+	job.for_fn = fn;
+	job.reduce_fn = NULL;
+	job.combine_fn = NULL;
+	job.ctx = ctx;
+
+	run_job(&job, begin, end);
+}
+
+long ut_parallel_reduce(long begin, long end, long grain, long identity,
+						ut_reduce_fn fn, ut_combine_fn combine, void *ctx)
+{
+	par_job_t job;
+
+	/* Nothing to reduce */
+	if (fn == NULL || combine == NULL || begin >= end) return identity;
+
+	job.grain = par_grain(begin, end, grain);
+	job.for_fn = NULL;
+	job.reduce_fn = fn;
+	job.combine_fn = combine;
+	job.ctx = ctx;
+
+	/* In the range's order, whoever ran the chunks */
+	return combine(identity, run_job(&job, begin, end), ctx);
+}
@@ -0,0 +1,104 @@
+/*
+ * ut_par.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Data-parallel loops on top of the task pool (see ut_task.h).
+ *  A range is split recursively in halves down to chunks of 'grain'
+ *  iterations; the upper halves are posted to the pool and the lower
+ *  ones are kept, so idle workers pick up big pieces first. Whoever
+ *  posted halves waits for them on a latch, running tasks meanwhile,
+ *  and when the pool is full the half runs in place - a loop never
+ *  waits for room in the queue, and needs memory only for the halves
+ *  in flight.
+ */
+
+#ifndef _UT_PAR_H
+#define _UT_PAR_H
+
+#include "ut.h"
+
+#define UT_PAR_AUTO_CHUNKS 64   // chunks per loop when no grain is given.
+
+/* A counting latch - opens once counted down to zero */
+typedef struct _ut_latch {
+  volatile long count;
+} ut_latch_t;
+
+/* Runs the iterations [begin, end) of a parallel loop */
+typedef void (*ut_for_fn)(long begin, long end, void *ctx);
+
+/* Reduces the iterations [begin, end) to a single value */
+typedef long (*ut_reduce_fn)(long begin, long end, void *ctx);
+
+/* Combines two reduced values (must be associative) */
+typedef long (*ut_combine_fn)(long a, long b, void *ctx);
+
+/*****************************************************************************
+ Initializes a latch.
+
+ Parameters:
+    latch - the latch.
+    count - the number of count downs that open it.
+ ****************************************************************************/
+void ut_latch_init(ut_latch_t *latch, long count);
+
+/*****************************************************************************
+ Counts a latch down by one, and wakes its waiters once it opens. May be
+ called from any thread or task.
+
+ Parameters:
+    latch - the latch.
+ ****************************************************************************/
+void ut_latch_count_down(ut_latch_t *latch);
+
+/*****************************************************************************
+ Waits until a latch is counted down to zero. While waiting, the calling
+ thread runs pending tasks of the pool, and blocks when there are none it may
+ run (see ut_task_wait()). Must be called from a thread.
+
+ Parameters:
+    latch - the latch.
+ ****************************************************************************/
+void ut_latch_wait(ut_latch_t *latch);
+
+/*****************************************************************************
+ Runs fn over the range [begin, end) in chunks of up to grain iterations,
+ on the workers of the pool and on the calling thread, and returns once all
+ the chunks are done. Runs serially when called from the main context, when
+ the pool wasn't initialized, and partly when the pool is full or when out
+ of memory.
+
+ Parameters:
+    begin - the first iteration.
+    end - one past the last iteration.
+    grain - the iterations per chunk, 0 to split the range into
+            UT_PAR_AUTO_CHUNKS chunks.
+    fn - the loop body, called once per chunk.
+    ctx - the argument passed to fn.
+ ****************************************************************************/
+void ut_parallel_for(long begin, long end, long grain,
+                     ut_for_fn fn, void *ctx);
+
+/*****************************************************************************
+ Reduces the range [begin, end) in parallel, like ut_parallel_for(). Every
+ chunk is reduced by fn, and the chunks' values are combined in the order of
+ the range - the result doesn't depend on which worker ran what.
+
+ Parameters:
+    begin - the first iteration.
+    end - one past the last iteration.
+    grain - the iterations per chunk, 0 for UT_PAR_AUTO_CHUNKS chunks.
+    identity - the result of an empty range.
+    fn - reduces a chunk.
+    combine - combines the values of two chunks.
+    ctx - the argument passed to fn and combine.
+
+ Returns:
+    identity combined with the values of all the chunks.
+ ****************************************************************************/
+long ut_parallel_reduce(long begin, long end, long grain, long identity,
+                        ut_reduce_fn fn, ut_combine_fn combine, void *ctx);
+
+#endif
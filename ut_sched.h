@@ -0,0 +1,403 @@
+/*
+ * ut_sched.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Extensions to the user-level threads library which can't be
+ *  declared in ut.h (that file is fixed by the course staff).
+ */
+
+#ifndef _UT_SCHED_H
+#define _UT_SCHED_H
+
+#include "ut.h"
+
+#define UT_HIST_BUCKETS 48      // log2 buckets, bucket i holds i-bit values.
+#define UT_QUANTUM_DECILES 11   // 0-9%, 10-19%, ..., 90-99%, 100%.
+#define UT_MAX_GROUPS 16        // the maximal number of thread groups.
+#define UT_INJECT_QUEUE_SIZE 256 // pending injected requests (a power of 2).
+#define UT_MIN_STACKSIZE 4096   // the smallest stack ut_set_stack_size() allows.
+
+/* A log-bucketed histogram */
+typedef struct _ut_hist {
+  unsigned long count;
+  unsigned long sum;
+  unsigned long max;
+  unsigned long buckets[UT_HIST_BUCKETS];
+} ut_hist_t;
+
+/* Scheduler health metrics, of a single thread or of all of them */
+typedef struct _ut_sched_stats {
+  ut_hist_t ready_latency_us;  // time from becoming ready to running.
+  ut_hist_t switch_cycles;     // CPU cycles spent in the scheduler per switch.
+  unsigned long quantum_use[UT_QUANTUM_DECILES]; // share of the quantum used.
+  unsigned long preempted;     // slices ended while still ready (incl. yield).
+  unsigned long blocked;       // slices ended by blocking, sleeping or exiting.
+} ut_sched_stats_t;
+
+/*****************************************************************************
+ Returns the TID of the calling thread.
+
+ Parameters:
+    None.
+
+ Returns:
+    the TID of the running thread.
+    SYS_ERR - if called before ut_start() or after all threads have finished
+              (i.e. from the original "main" context).
+ ****************************************************************************/
+tid_t ut_self(void);
+
+/*****************************************************************************
+ Returns the number of threads which haven't finished yet, the calling one
+ included. ut_start() returns once it drops to zero.
+ ****************************************************************************/
+unsigned int ut_num_live_threads(void);
+
+/*****************************************************************************
+ Gives up the rest of the calling thread's quantum, the scheduler switches
+ to the next thread immediately.
+
+ Parameters:
+    None.
+ ****************************************************************************/
+void ut_yield(void);
+
+/*****************************************************************************
+ Starts a critical section - the calling thread won't be preempted until the
+ matching ut_preempt_enable(). A quantum ending meanwhile is deferred to the
+ end of the section. Sections may be nested.
+
+ Parameters:
+    None.
+ ****************************************************************************/
+void ut_preempt_disable(void);
+
+/*****************************************************************************
+ Ends a critical section started by ut_preempt_disable().
+
+ Parameters:
+    None.
+ ****************************************************************************/
+void ut_preempt_enable(void);
+
+/*****************************************************************************
+ Blocks the calling thread on the given object (e.g. a semaphore) until
+ another thread wakes it with ut_wake_one(). Waiters are woken in FIFO order.
+ Should be called inside a critical section, after checking the object isn't
+ available, so no wake up is missed - the section is suspended while the
+ thread is blocked and resumed when it wakes up.
+
+ Parameters:
+    obj - the object to wait for.
+
+ Returns:
+    1 - if the waker handed the object directly to this thread.
+    0 - if the thread was just woken, and should try getting the object again.
+ ****************************************************************************/
+int ut_wait(void *obj);
+
+/*****************************************************************************
+ Like ut_wait(), but keeps the place in line of the thread's last wait. For a
+ thread which was woken but found the object taken (another thread got it
+ first), so it's still woken before the threads that came after it.
+
+ Parameters:
+    obj - the object to wait for.
+
+ Returns:
+    like ut_wait().
+ ****************************************************************************/
+int ut_wait_again(void *obj);
+
+/*****************************************************************************
+ Like ut_wait(), but waits no longer than the given time. Meanwhile the thread
+ counts as sleeping, so a simulation moves its clock on to the timeout rather
+ than report a deadlock.
+
+ Parameters:
+    obj - the object to wait for.
+    msec - the longest wait, in milliseconds.
+
+ Returns:
+    1 - if the waker handed the object directly to this thread.
+    0 - if the thread was woken or the time is up, and should try getting
+        the object again.
+ ****************************************************************************/
+int ut_wait_timeout(void *obj, unsigned long msec);
+
+/*****************************************************************************
+ Wakes the thread which waits the longest on the given object. Doesn't switch
+ to it. Should be called inside a critical section.
+
+ Parameters:
+    obj - the object waited for.
+    grant - non-zero to hand the object directly to the woken thread.
+
+ Returns:
+    the TID of the woken thread.
+    SYS_ERR - if no thread waits on obj.
+ ****************************************************************************/
+tid_t ut_wake_one(void *obj, int grant);
+
+/*****************************************************************************
+ Spawns a thread from anywhere - another pthread, a signal handler or a
+ running thread - also after ut_start(). Lock-free and async-signal-safe: the
+ request is queued, and the scheduler sets the thread up on its next switch
+ (switches happen on every profiler tick while a request is pending). Other
+ pthreads must block SIGALRM and SIGVTALRM, which belong to the scheduler.
+ Like the spawned threads, the thread runs with the signal mask ut_start()
+ was called with, even if it was injected before ut_start(). Once an injected
+ thread finishes, its stack is freed and its TID is given to a later injected
+ thread, so any number of them can run over time.
+ Must be called after ut_init().
+
+ Parameters:
+    func - a function to run in the new thread.
+    arg - an argument to be passed to func.
+
+ Returns:
+    the TID of the new thread - on success.
+    SYS_ERR - if the library isn't initialized or the queue is full.
+    TAB_FULL - if the threads table is full of unfinished threads.
+ ****************************************************************************/
+tid_t ut_inject_spawn(void (*func)(int), int arg);
+
+/*****************************************************************************
+ Wakes a thread blocked in ut_park(), from anywhere (see ut_inject_spawn()).
+ A wake up of a thread which isn't parked is kept, and its next ut_park()
+ returns at once.
+
+ Parameters:
+    tid - a thread ID.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if tid is invalid or the queue is full.
+ ****************************************************************************/
+int ut_inject_wake(tid_t tid);
+
+/*****************************************************************************
+ Blocks the calling thread until ut_inject_wake() is called for it (or
+ returns at once if it already was, since the last ut_park()).
+
+ Parameters:
+    None.
+ ****************************************************************************/
+void ut_park(void);
+
+/*****************************************************************************
+ Switches directly to the given ready thread, which gets the rest of the
+ calling thread's quantum.
+
+ Parameters:
+    tid - a thread ID.
+ ****************************************************************************/
+void ut_switch_to(tid_t tid);
+
+/*****************************************************************************
+ Turns the semaphore handoff mode on or off. When on, binsem_up() hands the
+ semaphore directly to its first waiter and switches to it at once, instead
+ of leaving it to wait for its turn in the round-robin.
+
+ Parameters:
+    enable - non-zero to turn the handoff on.
+ ****************************************************************************/
+void ut_set_handoff(int enable);
+
+/*****************************************************************************
+ Returns non-zero if the semaphore handoff mode is on.
+ ****************************************************************************/
+int ut_handoff_enabled(void);
+
+/*****************************************************************************
+ Turns adaptive time slices on or off (by default every quantum is 1 sec).
+ When on, the scheduler tracks each thread's average CPU burst - how long it
+ runs before blocking, sleeping or yielding - and gives it a quantum of twice
+ that, within the given bounds: CPU-bound threads get long slices and fewer
+ switches, bursty threads get short ones. Takes effect from the next switch.
+
+ Parameters:
+    min_us - the shortest quantum, in microseconds (0 turns it off).
+    max_us - the longest quantum, in microseconds.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if max_us is smaller than min_us.
+ ****************************************************************************/
+int ut_set_adaptive_slices(unsigned long min_us, unsigned long max_us);
+
+/*****************************************************************************
+ Returns the library's clock - the real monotonic time, or the virtual time
+ when running a simulation (see ut_sim_enable()).
+
+ Returns:
+    the current time, in milliseconds.
+ ****************************************************************************/
+unsigned long ut_now_ms(void);
+
+/*****************************************************************************
+ Suspends the calling thread for (at least) the given time. Other threads run
+ meanwhile. In a simulation, the virtual clock jumps forward as soon as all
+ the threads are waiting.
+
+ Parameters:
+    msec - the time to sleep, in milliseconds.
+ ****************************************************************************/
+void ut_sleep(unsigned long msec);
+
+/*****************************************************************************
+ Turns on the deterministic simulation mode. Must be called before
+ ut_start(). The scheduler is then driven by a virtual clock instead of
+ SIGALRM: threads are switched only at ut_sim_point(), ut_yield() and waits,
+ and each quantum lasts a pseudo-random number of preemption points drawn
+ from the seed. The same seed always replays the same interleaving. If all
+ the threads left block for good, the process exits with an error.
+
+ Parameters:
+    seed - the seed of the preemption points sequence.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if the threads are already running.
+ ****************************************************************************/
+int ut_sim_enable(unsigned long seed);
+
+/*****************************************************************************
+ A preemption point. In a simulation, stands for a millisecond of CPU work:
+ advances the virtual clock and the thread's vtime, and switches threads when
+ the quantum is over. Does nothing outside a simulation.
+
+ Parameters:
+    None.
+ ****************************************************************************/
+void ut_sim_point(void);
+
+/*****************************************************************************
+ Creates a thread group. The threads of a group share a CPU quota (see
+ ut_group_set_quota()); a new group has no quota.
+
+ Parameters:
+    None.
+
+ Returns:
+    the ID of the new group - on success.
+    TAB_FULL - if UT_MAX_GROUPS groups already exist.
+ ****************************************************************************/
+int ut_group_create(void);
+
+/*****************************************************************************
+ Moves a thread to a group. A thread belongs to a single group at a time,
+ threads which weren't added to any group are never throttled.
+
+ Parameters:
+    group - a group ID.
+    tid - a thread ID.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if group or tid is invalid.
+ ****************************************************************************/
+int ut_group_add(int group, tid_t tid);
+
+/*****************************************************************************
+ Limits the CPU time of a group, like the CPU bandwidth control of cgroups:
+ the group's threads may run for budget_us in every period_us. Once the
+ budget is used up, they aren't scheduled until the next period refills it.
+ CPU time is charged on every profiler tick (10 msec), so a group may overrun
+ its budget by up to a tick - the overrun is taken off the next budget.
+
+ Parameters:
+    group - a group ID.
+    period_us - the length of a period, in microseconds (0 for no quota).
+    budget_us - the CPU time allowed in a period, in microseconds.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if group is invalid, or budget_us is 0 with a quota.
+ ****************************************************************************/
+int ut_group_set_quota(int group, unsigned long period_us,
+                       unsigned long budget_us);
+
+/*****************************************************************************
+ Returns the scheduler health metrics collected since ut_start().
+
+ Parameters:
+    tid - a thread ID, or SYS_ERR for the metrics of all the threads.
+    stats - where to copy the metrics to.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if tid is invalid.
+ ****************************************************************************/
+int ut_get_sched_stats(tid_t tid, ut_sched_stats_t *stats);
+
+/*****************************************************************************
+ Adds a value to a histogram (e.g. to measure something of your own).
+
+ Parameters:
+    hist - the histogram, zeroed before its first value.
+    value - the value.
+ ****************************************************************************/
+void ut_hist_record(ut_hist_t *hist, unsigned long value);
+
+/*****************************************************************************
+ Estimates a percentile of a histogram. The values of the bucket it falls in
+ are taken as spread evenly over the bucket, and the estimate never exceeds
+ the largest value recorded.
+
+ Parameters:
+    hist - the histogram.
+    percent - the percentile wanted (e.g. 99).
+
+ Returns:
+    the estimated value, 0 for an empty histogram.
+ ****************************************************************************/
+unsigned long ut_hist_percentile(const ut_hist_t *hist, unsigned int percent);
+
+/*****************************************************************************
+ Sets the stack size of the threads spawned from now on (STACKSIZE by
+ default). The scheduler and the profiler run on a stack of their own, so a
+ thread's stack only has to hold the thread's own frames - and whatever else
+ runs on it: the dynamic linker resolves a library function on its first
+ call on the caller's stack, taking about 3 KB, so programs with small
+ stacks should be linked with -z now (or run with LD_BIND_NOW set). Signal
+ handlers of the program should be installed with SA_ONSTACK, to run on the
+ library's stack too.
+
+ Parameters:
+    size - the stack size, in bytes.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if size is smaller than UT_MIN_STACKSIZE.
+ ****************************************************************************/
+int ut_set_stack_size(unsigned long size);
+
+/*****************************************************************************
+ Turns on stack usage measurement. Every stack allocated by ut_spawn_thread()
+ from now on is filled with a canary pattern, and the high-water mark of these
+ threads is printed to stderr when the process exits. Threads spawned earlier
+ aren't measured.
+
+ Parameters:
+    None.
+ ****************************************************************************/
+void ut_enable_stack_hwm(void);
+
+/*****************************************************************************
+ Returns how deep the given thread's stack was used so far (the deepest byte
+ which no longer holds the canary pattern).
+
+ Parameters:
+    tid - a thread ID.
+
+ Returns:
+    the number of stack bytes used - on success.
+    SYS_ERR - if tid is invalid, or its stack was allocated before
+              ut_enable_stack_hwm() was called.
+ ****************************************************************************/
+long ut_get_stack_hwm(tid_t tid);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * ut_stats.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "ut_stats.h"
+#include "ut_sched.h"
+
+/* Semaphore waits, counted by the threads themselves.
+ * Copied into the segment by the scheduler.
+ */
+typedef struct _wait_counters {
+	volatile unsigned long blocks;
+	volatile unsigned long wait_us;
+} wait_counters_t;
+
+/* Global structures */
+static ut_stats_segment_t *s_segment = NULL;
+static wait_counters_t s_waits[UT_STATS_MAX_THREADS];
+static char s_path[256];  /* The segment's file, removed at exit */
+static int s_segment_fd = -1; /* Kept open, it holds the file's lock */
+
+/* Internal functions */
+
+/**
+ * Marks the start of a record update (sequence becomes odd).
+ */
+void seq_write_begin(volatile unsigned int *pSeq);
+
+/**
+ * Marks the end of a record update (sequence becomes even).
+ */
+void seq_write_end(volatile unsigned int *pSeq);
+
+/**
+ * Removes the segment's file. Registered with atexit().
+ */
+void remove_segment();
+
+/**
+ * Creates the segment's file, or takes over a stale one whose
+ * process is gone, and locks it for as long as we live.
+ * Never touches a live segment.
+ * @param path The file's path
+ * @return The file descriptor - Success
+ * 		   SYS_ERR - The name is taken, or on system failure
+ */
+int create_segment_file(const char *path);
+
+/* Implementations */
+void seq_write_begin(volatile unsigned int *pSeq)
+{
+	(*pSeq)++;
+	__sync_synchronize();
+}
+
+void seq_write_end(volatile unsigned int *pSeq)
+{
+	__sync_synchronize();
+	(*pSeq)++;
+}
+
+void remove_segment()
+{
+	unlink(s_path);
+}
+
+int create_segment_file(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		return SYS_ERR;
+	}
+
+	/* Held until the process is gone, even if it crashes.
+	 * Already held - a live process publishes under the name.
+	 */
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		close(fd);
+		errno = EEXIST;
+		return SYS_ERR;
+	}
+
+	/* Ours, a stale segment starts over */
+	if (ftruncate(fd, 0) < 0)
+	{
+		close(fd);
+		return SYS_ERR;
+	}
+
+	return fd;
+}
+
+int ut_stats_enable(const char *name)
+{
+	char path[256];
+	int fd;
+	void *pMap;
+
+	/* Must have a name, and publish in a single segment */
+	if (name == NULL || s_segment != NULL) return SYS_ERR;
+
+	snprintf(path, sizeof(path), "%s%s", UT_STATS_DIR, name);
+
+	/* A live segment of the same name is left alone */
+	fd = create_segment_file(path);
+	if (fd < 0)
+	{
+		return SYS_ERR;
+	}
+
+	/* Zero-filled by the system. On failure, the file is removed
+	 * while still locked, so it's never someone else's.
+	 */
+	if (ftruncate(fd, sizeof(ut_stats_segment_t)) < 0)
+	{
+		unlink(path);
+		close(fd);
+		return SYS_ERR;
+	}
+
+	pMap = mmap(NULL, sizeof(ut_stats_segment_t),
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (pMap == MAP_FAILED)
+	{
+		unlink(path);
+		close(fd);
+		return SYS_ERR;
+	}
+
+	/* Nobody else cleans up after us */
+	strcpy(s_path, path);
+	if (atexit(remove_segment) != 0)
+	{
+		munmap(pMap, sizeof(ut_stats_segment_t));
+		unlink(path);
+		close(fd);
+		return SYS_ERR;
+	}
+
+	s_segment = pMap;
+	s_segment_fd = fd;
+
+	seq_write_begin(&s_segment->header.seq);
+	s_segment->header.magic = UT_STATS_MAGIC;
+	s_segment->header.version = UT_STATS_VERSION;
+	s_segment->header.pid = getpid();
+	seq_write_end(&s_segment->header.seq);
+
+	return 0;
+}
+
+unsigned long ut_stats_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000UL;
+}
+
+void ut_stats_record_wait(unsigned long wait_us)
+{
+	tid_t tid = ut_self();
+
+	/* Only threads have counters */
+	if (tid < 0 || tid >= UT_STATS_MAX_THREADS) return;
+
+	s_waits[tid].blocks++;
+	s_waits[tid].wait_us += wait_us;
+}
+
+void ut_stats_publish_thread(tid_t tid, unsigned long vtime,
+							 unsigned long switches, int finished)
+{
+	ut_stats_thread_t *pRecord;
+
+	/* Not enabled */
+	if (s_segment == NULL) return;
+
+	/* Don't access illegal memory */
+	if (tid < 0 || tid >= UT_STATS_MAX_THREADS) return;
+
+	pRecord = &s_segment->threads[tid];
+
+	seq_write_begin(&pRecord->seq);
+	pRecord->finished = finished;
+	pRecord->vtime = vtime;
+	pRecord->switches = switches;
+	pRecord->blocks = s_waits[tid].blocks;
+	pRecord->sem_wait_us = s_waits[tid].wait_us;
+	seq_write_end(&pRecord->seq);
+}
+
+void ut_stats_publish_global(unsigned int num_threads,
+							 unsigned int run_queue_len)
+{
+	ut_stats_header_t *pHeader;
+
+	/* Not enabled */
+	if (s_segment == NULL) return;
+
+	pHeader = &s_segment->header;
+
+	seq_write_begin(&pHeader->seq);
+	pHeader->num_threads = num_threads;
+	pHeader->run_queue_len = run_queue_len;
+	pHeader->updates++;
+	seq_write_end(&pHeader->seq);
+}
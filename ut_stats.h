@@ -0,0 +1,112 @@
+/*
+ * ut_stats.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Live statistics of the user-level threads, published in a file
+ *  under /dev/shm which other processes can map and sample without
+ *  stopping or signalling the workload (see utstat.c).
+ *  Every record sits on its own cache line and is protected by a
+ *  sequence lock: the writer makes the sequence odd while updating,
+ *  a reader retries until it sees the same even sequence before and
+ *  after copying the record.
+ */
+
+#ifndef _UT_STATS_H
+#define _UT_STATS_H
+
+#include "ut.h"
+
+#define UT_STATS_DIR "/dev/shm/"    // where the segments are created.
+#define UT_STATS_MAGIC 0x75747374   // "utst"
+#define UT_STATS_VERSION 1
+#define UT_STATS_MAX_THREADS (MAX_TAB_SIZE + 1)
+#define UT_STATS_CACHE_LINE 64
+
+/* Global counters, at the start of the segment */
+typedef struct _ut_stats_header {
+	volatile unsigned int seq;
+	unsigned int magic;
+	unsigned int version;
+	unsigned int pid;
+	unsigned int num_threads;       // the number of thread records in use.
+	unsigned int run_queue_len;     // ready threads waiting for the CPU.
+	unsigned long updates;          // how many times the segment was updated.
+} __attribute__((aligned(UT_STATS_CACHE_LINE))) ut_stats_header_t;
+
+/* Counters of a single thread */
+typedef struct _ut_stats_thread {
+	volatile unsigned int seq;
+	unsigned int finished;          // 1 once the thread has returned.
+	unsigned long vtime;            // CPU time consumed (msec).
+	unsigned long switches;         // times the thread was switched in.
+	unsigned long blocks;           // times the thread waited on a semaphore.
+	unsigned long sem_wait_us;      // total time spent waiting on semaphores.
+} __attribute__((aligned(UT_STATS_CACHE_LINE))) ut_stats_thread_t;
+
+/* The whole segment */
+typedef struct _ut_stats_segment {
+	ut_stats_header_t header;
+	ut_stats_thread_t threads[UT_STATS_MAX_THREADS];  // indexed by TID.
+} ut_stats_segment_t;
+
+/*****************************************************************************
+ Creates the statistics segment UT_STATS_DIR<name> and starts publishing the
+ counters in it, on every profiler tick. The segment's file is removed when
+ the process exits normally. After a crash it's left behind - utstat reports
+ it as stale, and the next ut_stats_enable() of the same name replaces it.
+ A segment of a live process is never replaced (e.g. use a name with the
+ process ID to run several instances).
+
+ Parameters:
+    name - the segment's file name.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - on system failure, if a segment was already created, or if
+              a live process publishes under that name.
+ ****************************************************************************/
+int ut_stats_enable(const char *name);
+
+/*****************************************************************************
+ Records a semaphore wait of the calling thread. Called by the semaphores
+ library once the thread gets the semaphore.
+
+ Parameters:
+    wait_us - how long the thread waited (usec).
+ ****************************************************************************/
+void ut_stats_record_wait(unsigned long wait_us);
+
+/*****************************************************************************
+ Returns the clock used to measure waits.
+
+ Returns:
+    the current time, in microseconds.
+ ****************************************************************************/
+unsigned long ut_stats_now_us(void);
+
+/*****************************************************************************
+ Publishes the counters of a single thread. Called by the scheduler with all
+ signals blocked, so updates never interleave.
+
+ Parameters:
+    tid - the thread ID.
+    vtime - the thread's CPU time (msec).
+    switches - the number of times the thread was switched in.
+    finished - non-zero if the thread has returned.
+ ****************************************************************************/
+void ut_stats_publish_thread(tid_t tid, unsigned long vtime,
+							 unsigned long switches, int finished);
+
+/*****************************************************************************
+ Publishes the global counters. Called like ut_stats_publish_thread().
+
+ Parameters:
+    num_threads - the number of spawned threads.
+    run_queue_len - the number of ready threads waiting for the CPU.
+ ****************************************************************************/
+void ut_stats_publish_global(unsigned int num_threads,
+							 unsigned int run_queue_len);
+
+#endif
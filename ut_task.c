@@ -0,0 +1,536 @@
+/*
+ * ut_task.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ */
+
+#include <stdlib.h>
+
+#include "ut_task.h"
+#include "ut_sched.h"
+
+/* Internal definitions */
+#define QUEUE_MASK (UT_TASK_QUEUE_SIZE - 1)
+
+#define IDLE_WAIT_MSEC (1000) /* Blocked for good, an idle pool would look deadlocked */
+
+/* Future states */
+#define FUTURE_FREE (0)
+#define FUTURE_PENDING (1)
+#define FUTURE_DONE (2)
+
+struct _ut_future {
+	volatile int state;
+	void *result;
+};
+
+/* A queue cell. The sequence number tells whether the cell
+ * is ready to be written or read (bounded MPMC queue).
+ */
+typedef struct _task_cell {
+	volatile unsigned long seq;
+	ut_task_fn fn;
+	void *ctx;
+	ut_future_t *future;
+} task_cell_t;
+
+/* What a thread in ut_task_wait() waits for */
+typedef struct _task_wait {
+	int (*done)(void *ctx);
+	void *ctx;
+} task_wait_t;
+
+/* Global structures */
+static task_cell_t s_queue[UT_TASK_QUEUE_SIZE];
+static volatile unsigned long s_queue_head = 0;
+static volatile unsigned long s_queue_tail = 0;
+static ut_future_t s_futures[UT_TASK_MAX_FUTURES];
+static volatile unsigned int s_futures_hint = 0;
+static int s_pool_initialized = 0;
+static int s_nesting[MAX_TAB_SIZE + 1]; /* Tasks run by ut_task_run_one(), per slot */
+static volatile int s_idle_workers = 0;   /* Waiting on it for a task */
+static volatile int s_waiters = 0;        /* Waiting on it for any change */
+
+/* Internal functions */
+
+/**
+ * Initializes the queue cells' sequence numbers.
+ */
+void init_queue();
+
+/**
+ * Puts a task in the queue.
+ * Never blocks - a thread preempted in the middle only
+ * delays the consumer of that very cell.
+ * @return 0 - Success
+ * 		   SYS_ERR - Queue is full
+ */
+int enqueue_task(ut_task_fn fn, void *ctx, ut_future_t *future);
+
+/**
+ * Takes a task out of the queue.
+ * @return 0 - Success
+ * 		   SYS_ERR - Queue is empty
+ */
+int dequeue_task(task_cell_t *pTask);
+
+/**
+ * Returns non-zero if the next task in the queue is published.
+ */
+int queue_ready();
+
+/**
+ * Returns non-zero if there is room for a task in the queue.
+ */
+int queue_has_room();
+
+/**
+ * Wakes an idle worker, if one waits.
+ */
+void wake_idle_worker();
+
+/**
+ * Wakes every thread waiting for a change in the pool
+ * (a task posted, taken or done, or a future released).
+ */
+void wake_waiters();
+
+/**
+ * Blocks until the pool changes, unless ready(ctx) holds. Checked
+ * in a critical section, so no change in between is missed.
+ */
+void wait_for_change(int (*ready)(void *ctx), void *ctx);
+
+/**
+ * Finds a free future and marks it as pending.
+ * @return The future, NULL if all are in use
+ */
+ut_future_t *alloc_future();
+
+/**
+ * Wait conditions, for wait_for_change().
+ */
+int has_room(void *ctx);
+int has_free_future(void *ctx);
+int wait_over(void *ctx);
+int future_done(void *ctx);
+
+/**
+ * Runs a task taken from the queue and
+ * publishes the result in its future.
+ */
+void run_task(task_cell_t *pTask);
+
+/**
+ * Main loop of a pool's worker thread.
+ * @param index Worker number (unused)
+ */
+void task_worker(int index);
+
+/* Implementations */
+void init_queue()
+{
+	unsigned long i;
+
+	for (i = 0; i < UT_TASK_QUEUE_SIZE; ++i)
+	{
+		s_queue[i].seq = i;
+	}
+
+	s_queue_head = 0;
+	s_queue_tail = 0;
+}
+
+int enqueue_task(ut_task_fn fn, void *ctx, ut_future_t *future)
+{
+	unsigned long pos = s_queue_tail;
+	task_cell_t *pCell;
+
+	while (1)
+	{
+		long diff;
+
+		pCell = &s_queue[pos & QUEUE_MASK];
+		diff = (long)pCell->seq - (long)pos;
+
+		/* Cell is free, try claiming it */
+		if (diff == 0)
+		{
+			if (__sync_bool_compare_and_swap(&s_queue_tail, pos, pos + 1))
+			{
+				break;
+			}
+			pos = s_queue_tail;
+		}
+		/* Cell wasn't consumed yet, the queue is full */
+		else if (diff < 0)
+		{
+			return SYS_ERR;
+		}
+		/* Someone else claimed it, try again */
+		else
+		{
+			pos = s_queue_tail;
+		}
+	}
+
+	pCell->fn = fn;
+	pCell->ctx = ctx;
+	pCell->future = future;
+
+	/* Publish the cell to the consumers */
+	__sync_synchronize();
+	pCell->seq = pos + 1;
+
+	wake_idle_worker();
+	wake_waiters();
+
+	return 0;
+}
+
+int dequeue_task(task_cell_t *pTask)
+{
+	unsigned long pos = s_queue_head;
+	task_cell_t *pCell;
+
+	while (1)
+	{
+		long diff;
+
+		pCell = &s_queue[pos & QUEUE_MASK];
+		diff = (long)pCell->seq - (long)(pos + 1);
+
+		/* Cell is published, try claiming it */
+		if (diff == 0)
+		{
+			if (__sync_bool_compare_and_swap(&s_queue_head, pos, pos + 1))
+			{
+				break;
+			}
+			pos = s_queue_head;
+		}
+		/* Nothing published here yet, the queue is empty */
+		else if (diff < 0)
+		{
+			return SYS_ERR;
+		}
+		/* Someone else took it, try again */
+		else
+		{
+			pos = s_queue_head;
+		}
+	}
+
+	*pTask = *pCell;
+
+	/* Hand the cell back to the producers, one lap later */
+	__sync_synchronize();
+	pCell->seq = pos + UT_TASK_QUEUE_SIZE;
+
+	/* Room for whoever waits to post */
+	wake_waiters();
+
+	return 0;
+}
+
+int queue_ready()
+{
+	return s_queue[s_queue_head & QUEUE_MASK].seq == s_queue_head + 1;
+}
+
+int queue_has_room()
+{
+	return s_queue[s_queue_tail & QUEUE_MASK].seq == s_queue_tail;
+}
+
+void wake_idle_worker()
+{
+	if (s_idle_workers > 0)
+	{
+		ut_preempt_disable();
+		ut_wake_one((void *)&s_idle_workers, 0);
+		ut_preempt_enable();
+	}
+}
+
+void wake_waiters()
+{
+	if (s_waiters > 0)
+	{
+		ut_preempt_disable();
+		while (ut_wake_one((void *)&s_waiters, 0) >= 0);
+		ut_preempt_enable();
+	}
+}
+
+void wait_for_change(int (*ready)(void *ctx), void *ctx)
+{
+	ut_preempt_disable();
+	if (!ready(ctx))
+	{
+		s_waiters++;
+		ut_wait((void *)&s_waiters);
+		s_waiters--;
+	}
+	ut_preempt_enable();
+}
+
+ut_future_t *alloc_future()
+{
+	unsigned int start = s_futures_hint;
+	unsigned int i;
+
+	/* Start where the last allocation ended, most of
+	 * the futures behind it are still in use.
+	 */
+	for (i = 0; i < UT_TASK_MAX_FUTURES; ++i)
+	{
+		unsigned int index = (start + i) % UT_TASK_MAX_FUTURES;
+		ut_future_t *pFuture = &s_futures[index];
+
+		if (pFuture->state == FUTURE_FREE &&
+			__sync_bool_compare_and_swap(&pFuture->state,
+										 FUTURE_FREE,
+										 FUTURE_PENDING))
+		{
+			s_futures_hint = index + 1;
+			return pFuture;
+		}
+	}
+
+	return NULL;
+}
+
+void run_task(task_cell_t *pTask)
+{
+	void *result = pTask->fn(pTask->ctx);
+
+	/* Nobody is interested in the result */
+	if (pTask->future == NULL) return;
+
+	pTask->future->result = result;
+
+	/* Result must be visible before the state */
+	__sync_synchronize();
+	pTask->future->state = FUTURE_DONE;
+
+	wake_waiters();
+}
+
+int has_room(void *ctx)
+{
+	return queue_has_room();
+}
+
+int has_free_future(void *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < UT_TASK_MAX_FUTURES; ++i)
+	{
+		if (s_futures[i].state == FUTURE_FREE) return 1;
+	}
+
+	return 0;
+}
+
+int wait_over(void *ctx)
+{
+	task_wait_t *pWait = ctx;
+
+	/* Done, or there's a task this thread may run */
+	return pWait->done(pWait->ctx) ||
+		   (queue_ready() && ut_task_nesting() < UT_TASK_MAX_NESTING);
+}
+
+void task_worker(int index)
+{
+	task_cell_t task;
+
+	while (1)
+	{
+		/* Nothing to do, wait for a post. Checked again in a
+		 * critical section, so no post is missed.
+		 */
+		if (dequeue_task(&task) != 0)
+		{
+			ut_preempt_disable();
+			if (!queue_ready())
+			{
+				s_idle_workers++;
+				ut_wait_timeout((void *)&s_idle_workers, IDLE_WAIT_MSEC);
+				s_idle_workers--;
+			}
+			ut_preempt_enable();
+			continue;
+		}
+
+		run_task(&task);
+	}
+}
+
+int ut_task_pool_init(int num_workers)
+{
+	int i;
+
+	/* At least one worker */
+	if (num_workers < 1)
+	{
+		return SYS_ERR;
+	}
+
+	/* Queue is shared by all the workers */
+	if (!s_pool_initialized)
+	{
+		init_queue();
+		s_pool_initialized = 1;
+	}
+
+	for (i = 0; i < num_workers; ++i)
+	{
+		tid_t tid = ut_spawn_thread(task_worker, i);
+
+		if (tid < 0)
+		{
+			return tid;
+		}
+	}
+
+	return 0;
+}
+
+ut_future_t *ut_task_submit(ut_task_fn fn, void *ctx)
+{
+	ut_future_t *pFuture;
+
+	/* No pool to run it */
+	if (!s_pool_initialized) return NULL;
+
+	/* Get a future, or wait for one to be collected */
+	while ((pFuture = alloc_future()) == NULL)
+	{
+		if (ut_self() < 0) return NULL;
+		wait_for_change(has_free_future, NULL);
+	}
+
+	/* Get room in the queue, or wait for the workers */
+	while (enqueue_task(fn, ctx, pFuture) != 0)
+	{
+		if (ut_self() < 0)
+		{
+			pFuture->state = FUTURE_FREE;
+			return NULL;
+		}
+		wait_for_change(has_room, NULL);
+	}
+
+	return pFuture;
+}
+
+int ut_task_post(ut_task_fn fn, void *ctx)
+{
+	/* No pool to run it */
+	if (!s_pool_initialized) return SYS_ERR;
+
+	/* Get room in the queue, or wait for the workers */
+	while (enqueue_task(fn, ctx, NULL) != 0)
+	{
+		if (ut_self() < 0) return SYS_ERR;
+		wait_for_change(has_room, NULL);
+	}
+
+	return 0;
+}
+
+int ut_task_try_post(ut_task_fn fn, void *ctx)
+{
+	/* No pool to run it */
+	if (!s_pool_initialized) return SYS_ERR;
+
+	return enqueue_task(fn, ctx, NULL);
+}
+
+int ut_task_run_one(void)
+{
+	int *pNesting = &s_nesting[ut_self() + 1];
+	task_cell_t task;
+
+	/* Deep enough, the stack must not grow any further */
+	if (*pNesting >= UT_TASK_MAX_NESTING)
+	{
+		return 0;
+	}
+
+	if (dequeue_task(&task) != 0)
+	{
+		return 0;
+	}
+
+	(*pNesting)++;
+	run_task(&task);
+	(*pNesting)--;
+
+	return 1;
+}
+
+int ut_task_nesting(void)
+{
+	return s_nesting[ut_self() + 1];
+}
+
+void ut_task_wait(int (*done)(void *ctx), void *ctx)
+{
+	task_wait_t wait;
+
+	wait.done = done;
+	wait.ctx = ctx;
+
+	while (!done(ctx))
+	{
+		/* Help the workers, block only if there's nothing to do */
+		if (!ut_task_run_one())
+		{
+			wait_for_change(wait_over, &wait);
+		}
+	}
+}
+
+void ut_task_notify(void)
+{
+	wake_waiters();
+}
+
+int future_done(void *ctx)
+{
+	ut_future_t *pFuture = ctx;
+
+	return pFuture->state == FUTURE_DONE;
+}
+
+void ut_future_wait(ut_future_t *future)
+{
+	/* Must be a valid future */
+	if (future == NULL) return;
+
+	ut_task_wait(future_done, future);
+}
+
+void *ut_future_get(ut_future_t *future)
+{
+	void *result;
+
+	/* Must be a valid future */
+	if (future == NULL) return NULL;
+
+	ut_future_wait(future);
+
+	result = future->result;
+
+	/* Done with it, can be reused */
+	__sync_synchronize();
+	future->state = FUTURE_FREE;
+	wake_waiters();
+
+	return result;
+}
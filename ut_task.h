@@ -0,0 +1,162 @@
+/*
+ * ut_task.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  A task pool on top of the user-level threads library.
+ *  A fixed set of worker threads (spawned once, so their stacks are
+ *  reused for every task) runs short tasks taken from a bounded queue.
+ *  Each submitted task gets a future, which its result is read from.
+ *  Idle workers and waiters block rather than spin, so an idle pool
+ *  takes no CPU and doesn't stop a simulation's clock.
+ */
+
+#ifndef _UT_TASK_H
+#define _UT_TASK_H
+
+#include "ut.h"
+
+#define UT_TASK_QUEUE_SIZE 4096  // max pending tasks (must be a power of 2).
+#define UT_TASK_MAX_FUTURES 4096 // max futures not yet collected.
+#define UT_TASK_MAX_NESTING 16   // max tasks a waiting thread runs nested.
+
+/* A task gets a context pointer and returns its result */
+typedef void *(*ut_task_fn)(void *ctx);
+
+/* The future of a submitted task. Opaque. */
+typedef struct _ut_future ut_future_t;
+
+/*****************************************************************************
+ Creates the worker threads of the pool. Must be called after ut_init() and
+ before ut_start(), as the workers are regular threads in the threads table.
+
+ Parameters:
+    num_workers - the number of worker threads.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - on system failure.
+    TAB_FULL - if the threads table can't hold all the workers.
+ ****************************************************************************/
+int ut_task_pool_init(int num_workers);
+
+/*****************************************************************************
+ Submits a task to the pool. When called from a thread and the pool is full,
+ the thread blocks until there is room.
+
+ Parameters:
+    fn - the task function.
+    ctx - the argument passed to fn.
+
+ Returns:
+    the task's future - on success.
+    NULL - if the pool wasn't initialized, or it is full and the caller is
+           the main context.
+ ****************************************************************************/
+ut_future_t *ut_task_submit(ut_task_fn fn, void *ctx);
+
+/*****************************************************************************
+ Submits a task whose result isn't needed (no future is allocated).
+
+ Parameters:
+    fn - the task function.
+    ctx - the argument passed to fn.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if the pool wasn't initialized, or it is full and the caller
+              is the main context.
+ ****************************************************************************/
+int ut_task_post(ut_task_fn fn, void *ctx);
+
+/*****************************************************************************
+ Submits a task whose result isn't needed, only if there is room right now.
+ Unlike ut_task_post(), never waits - for callers that can run the task
+ themselves instead.
+
+ Parameters:
+    fn - the task function.
+    ctx - the argument passed to fn.
+
+ Returns:
+    0 - on success.
+    SYS_ERR - if the pool wasn't initialized, or it is full.
+ ****************************************************************************/
+int ut_task_try_post(ut_task_fn fn, void *ctx);
+
+/*****************************************************************************
+ Runs a single pending task in the calling thread, if there is one. Used by
+ threads that wait for other tasks, so waiting never starves the pool.
+ A task run this way may wait and run another one in turn; to bound the
+ thread's stack, no task is run once UT_TASK_MAX_NESTING are nested.
+
+ Parameters:
+    None.
+
+ Returns:
+    1 - if a task was run.
+    0 - if no task was pending, or the nesting limit was reached.
+ ****************************************************************************/
+int ut_task_run_one(void);
+
+/*****************************************************************************
+ Returns the number of tasks ut_task_run_one() is running nested in the
+ calling thread - 0 outside of such tasks. Once it reaches
+ UT_TASK_MAX_NESTING, the thread runs no more pending tasks while waiting.
+
+ Parameters:
+    None.
+
+ Returns:
+    the nesting depth of the calling thread.
+ ****************************************************************************/
+int ut_task_nesting(void);
+
+/*****************************************************************************
+ Waits until done(ctx) returns non-zero. While waiting, the calling thread
+ runs other pending tasks like ut_future_wait(), and blocks when there are
+ none it may run. Whatever makes done() true must call ut_task_notify()
+ afterwards, or the waiter may not notice. Must be called from a thread.
+
+ Parameters:
+    done - tells whether the wait is over.
+    ctx - the argument passed to done.
+ ****************************************************************************/
+void ut_task_wait(int (*done)(void *ctx), void *ctx);
+
+/*****************************************************************************
+ Wakes the threads blocked in ut_task_wait() (and the pool's own waiters),
+ to check their condition again.
+
+ Parameters:
+    None.
+ ****************************************************************************/
+void ut_task_notify(void);
+
+/*****************************************************************************
+ Waits until the task of the given future is done. While waiting, the
+ calling thread runs other pending tasks (so it's safe to wait from inside
+ a task), or only blocks when UT_TASK_MAX_NESTING tasks are already nested
+ in it. Chains of tasks waiting for each other must therefore stay shorter
+ than UT_TASK_MAX_NESTING times the number of threads that wait, or the
+ innermost ones may never run. Must be called from a thread.
+
+ Parameters:
+    future - a future returned by ut_task_submit().
+ ****************************************************************************/
+void ut_future_wait(ut_future_t *future);
+
+/*****************************************************************************
+ Waits for the task and collects its result. The future is released, and
+ can't be used after this call.
+
+ Parameters:
+    future - a future returned by ut_task_submit().
+
+ Returns:
+    the value returned by the task.
+ ****************************************************************************/
+void *ut_future_get(ut_future_t *future);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * utstat.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Or Dahan 201644929
+ *
+ *  Samples the statistics segment published by ut_stats_enable()
+ *  from another process, without stopping or signalling the workload.
+ *
+ *  Usage: utstat NAME [INTERVAL_MSEC [COUNT]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "ut_stats.h"
+
+#define DEFAULT_INTERVAL_MSEC (1000)
+#define SEQ_SPIN_TRIES (100)        /* An update takes a few stores */
+#define SEQ_MAX_BACKOFF_NSEC (10000000)
+
+/**
+ * Tells whether the process which published
+ * the segment is gone.
+ * @param pSegment The mapped segment
+ */
+int writer_gone(ut_stats_segment_t *pSegment)
+{
+	/* Written once, before the first sequence update ended */
+	pid_t pid = pSegment->header.pid;
+
+	return kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+/**
+ * Copies a sequence-locked record, retrying until
+ * the copy isn't torn by a concurrent update.
+ * A writer that died in the middle of an update leaves
+ * the sequence odd, a live one finishes it however long
+ * it's stopped or descheduled. So after a few quick
+ * retries, it's checked for and waited for, sleeping
+ * longer each time.
+ * @param pSegment The mapped segment
+ * @param pSeq The record's sequence number
+ * @param pDst Where to copy the record to
+ * @param pSrc The record in the segment
+ * @param size Size of the record
+ * @return 0 - Success
+ * 		   -1 - The writer died in the middle of an update
+ */
+int seq_read(ut_stats_segment_t *pSegment, volatile unsigned int *pSeq,
+			 void *pDst, const volatile void *pSrc, size_t size)
+{
+	struct timespec backoff = { 0, 1000 };
+	unsigned int before, after;
+	long tries;
+
+	for (tries = 0; ; ++tries)
+	{
+		before = *pSeq;
+
+		/* Even - no update in progress, try copying */
+		if (!(before & 1))
+		{
+			__sync_synchronize();
+			memcpy(pDst, (const void *)pSrc, size);
+			__sync_synchronize();
+
+			after = *pSeq;
+			if (before == after) return 0;
+		}
+
+		if (tries < SEQ_SPIN_TRIES) continue;
+
+		if (writer_gone(pSegment)) return -1;
+
+		nanosleep(&backoff, NULL);
+		if (backoff.tv_nsec < SEQ_MAX_BACKOFF_NSEC / 2)
+		{
+			backoff.tv_nsec *= 2;
+		}
+	}
+}
+
+/**
+ * Prints a single sample of the segment.
+ * @param pSegment The mapped segment
+ * @return 0 - Success
+ * 		   -1 - The writer died in the middle of an update
+ */
+int print_sample(ut_stats_segment_t *pSegment)
+{
+	ut_stats_header_t header;
+	ut_stats_thread_t thread;
+	unsigned int tid;
+
+	if (seq_read(pSegment, &pSegment->header.seq, &header,
+				 &pSegment->header, sizeof(header)) != 0)
+	{
+		return -1;
+	}
+
+	printf("pid %u, %u threads, run queue %u, update %lu\n",
+		   header.pid, header.num_threads,
+		   header.run_queue_len, header.updates);
+	printf("%5s %12s %10s %10s %14s\n",
+		   "TID", "VTIME(ms)", "SWITCHES", "BLOCKS", "SEM_WAIT(us)");
+
+	for (tid = 0;
+		 tid < header.num_threads && tid < UT_STATS_MAX_THREADS;
+		 ++tid)
+	{
+		if (seq_read(pSegment, &pSegment->threads[tid].seq, &thread,
+					 &pSegment->threads[tid], sizeof(thread)) != 0)
+		{
+			return -1;
+		}
+
+		printf("%5u %12lu %10lu %10lu %14lu%s\n",
+			   tid, thread.vtime, thread.switches,
+			   thread.blocks, thread.sem_wait_us,
+			   thread.finished ? " (finished)" : "");
+	}
+
+	printf("\n");
+	fflush(stdout);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char path[256];
+	int fd;
+	int interval_msec = DEFAULT_INTERVAL_MSEC;
+	long count = -1;
+	ut_stats_segment_t *pSegment;
+
+	if (argc < 2 || argc > 4)
+	{
+		printf("Usage: %s NAME [INTERVAL_MSEC [COUNT]]\n", argv[0]);
+		exit(1);
+	}
+
+	if (argc > 2) interval_msec = atoi(argv[2]);
+	if (argc > 3) count = atol(argv[3]);
+
+	snprintf(path, sizeof(path), "%s%s", UT_STATS_DIR, argv[1]);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		perror(path);
+		exit(1);
+	}
+
+	pSegment = mmap(NULL, sizeof(ut_stats_segment_t),
+					PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (pSegment == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+
+	if (pSegment->header.magic != UT_STATS_MAGIC ||
+		pSegment->header.version != UT_STATS_VERSION)
+	{
+		printf("%s is not a statistics segment\n", path);
+		exit(1);
+	}
+
+	while (count != 0)
+	{
+		/* Left behind by a process that didn't exit normally */
+		if (writer_gone(pSegment))
+		{
+			printf("%s is stale, process %u is gone\n",
+				   path, pSegment->header.pid);
+			exit(1);
+		}
+
+		if (print_sample(pSegment) != 0)
+		{
+			printf("%s is stale, process %u died in the middle "
+				   "of an update\n", path, pSegment->header.pid);
+			exit(1);
+		}
+
+		if (count > 0) count--;
+		if (count != 0) usleep(interval_msec * 1000);
+	}
+
+	return 0;
+}